@@ -1,3 +1,7 @@
+#include <algorithm>
+using std::sort;
+using std::pair;
+
 #include "../main/common.hpp"
 #include "inst.hpp"
 
@@ -14,9 +18,29 @@ void InstRoot::output_asm(list<string> &buf) {
         outasm("");
     }
 
-    outasm("#--- ARRAY DECL");
+    /*
+     * small arrays go to .sbss (.sdata if initialized) right after the scalars in .sdata,
+     * so that they stay in the 4 KiB window around gp, where the linker relaxes
+     * `lui + lw/sw %lo` into one gp-relative lw/sw; larger arrays are left as common
+     * symbols, or go to .data / .rodata if initialized
+     */
+    vector<InstDeclArray*> arrays;
     for(auto arraypair: decl_arrays)
-        arraypair.second->output_asm(buf);
+        arrays.push_back(arraypair.second);
+    sort(arrays.begin(), arrays.end(), [](InstDeclArray *a, InstDeclArray *b) {
+        return a->totbytes!=b->totbytes ? a->totbytes<b->totbytes : a->globalidx<b->globalidx;
+    });
+
+    int smallbytes = decl_scalars.size() * 4;
+    for(auto array: arrays)
+        if(!array->readonly && array->totbytes<=SMALL_DATA_MAX_BYTES && smallbytes+array->totbytes<=SMALL_DATA_WINDOW_BYTES) {
+            array->small = true;
+            smallbytes += array->totbytes;
+        }
+
+    outasm("#--- ARRAY DECL");
+    for(auto array: arrays)
+        array->output_asm(buf);
 
     outasm("");
     for(auto fn: funcs) {
@@ -38,10 +62,46 @@ void InstDeclScalar::output_asm(list<string> &buf) {
 }
 
 void InstDeclArray::output_asm(list<string> &buf) {
-    outasm("  .comm v%d, %d, 4", globalidx, totbytes);
+    if(initval.empty() && !readonly) {
+        if(small) {
+            outasm("  .global   v%d", globalidx);
+            outasm("  .section  .sbss,\"aw\",@nobits");
+            outasm("  .align    2");
+            outasm("  .type     v%d, @object", globalidx);
+            outasm("  .size     v%d, %d", globalidx, totbytes);
+            outasm("v%d:", globalidx);
+            outasm("  .zero     %d", totbytes);
+            outasm("");
+        } else {
+            outasm("  .comm v%d, %d, 4", globalidx, totbytes);
+        }
+        return;
+    }
+
+    // initialized: words in offset order, gaps as zeros
+    vector<pair<int, int>> words(initval.begin(), initval.end());
+    sort(words.begin(), words.end());
+
+    outasm("  .global   v%d", globalidx);
+    outasm("  .section  %s", readonly ? ".rodata" : small ? ".sdata" : ".data");
+    outasm("  .align    2");
+    outasm("  .type     v%d, @object", globalidx);
+    outasm("  .size     v%d, %d", globalidx, totbytes);
+    outasm("v%d:", globalidx);
+    int pos = 0;
+    for(auto word: words) {
+        if(word.first>pos)
+            outasm("  .zero     %d", word.first-pos);
+        outasm("  .word     %d", word.second);
+        pos = word.first+4;
+    }
+    if(totbytes>pos)
+        outasm("  .zero     %d", totbytes-pos);
+    outasm("");
 }
 
-#define STK(stacksize) (((stacksize)/4 + 1) * 16)
+// frame size in bytes: spill area, plus ra for non-leaf funcs, aligned to 16 bytes
+#define STK(func) ((((func)->stacksize + ((func)->isleaf ? 0 : 1)) * 4 + 15) / 16 * 16)
 
 void InstFuncDef::output_asm(list<string> &buf) {
 
@@ -57,11 +117,11 @@ void InstFuncDef::output_asm(list<string> &buf) {
         outasm("  sw      ra, -4(sp)");
 
     if(!isleaf || stacksize>0) {
-        if(imm_overflows(-STK(stacksize))) {
-            outasm("  li     t0, %d", -STK(stacksize));
+        if(imm_overflows(-STK(this))) {
+            outasm("  li     t0, %d", -STK(this));
             outasm("  add    sp, sp, t0");
         } else {
-            outasm("  addi    sp, sp, %d", -STK(stacksize));
+            outasm("  addi    sp, sp, %d", -STK(this));
         }
     }
 
@@ -112,6 +172,15 @@ void InstOpBinary::output_asm(list<string> &buf) {
             outstmt("xor %s, %s, %s", tig(dest), tig(operand1), tig(operand2));
             outstmt("snez %s, %s", tig(dest), tig(dest));
             break;
+        case OpBitAnd:
+            outstmt("and %s, %s, %s", tig(dest), tig(operand1), tig(operand2));
+            break;
+        case OpBitOr:
+            outstmt("or %s, %s, %s", tig(dest), tig(operand1), tig(operand2));
+            break;
+        case OpBitXor:
+            outstmt("xor %s, %s, %s", tig(dest), tig(operand1), tig(operand2));
+            break;
         case OpAnd:
         case OpOr:
         default:
@@ -120,6 +189,53 @@ void InstOpBinary::output_asm(list<string> &buf) {
     }
 }
 
+void InstOpBinaryI::output_asm(list<string> &buf) {
+    switch(op) {
+        case OpLess:
+            outstmt("slti %s, %s, %d", tig(dest), tig(operand1), operand2);
+            break;
+        case OpLeq:
+            outstmt("slti %s, %s, %d", tig(dest), tig(operand1), operand2+1);
+            break;
+        case OpGreater:
+            outstmt("slti %s, %s, %d", tig(dest), tig(operand1), operand2+1);
+            outstmt("xori %s, %s, 1", tig(dest), tig(dest));
+            break;
+        case OpGeq:
+            outstmt("slti %s, %s, %d", tig(dest), tig(operand1), operand2);
+            outstmt("xori %s, %s, 1", tig(dest), tig(dest));
+            break;
+        case OpEq:
+            if(operand2==0)
+                outstmt("seqz %s, %s", tig(dest), tig(operand1));
+            else {
+                outstmt("xori %s, %s, %d", tig(dest), tig(operand1), operand2);
+                outstmt("seqz %s, %s", tig(dest), tig(dest));
+            }
+            break;
+        case OpNeq:
+            if(operand2==0)
+                outstmt("snez %s, %s", tig(dest), tig(operand1));
+            else {
+                outstmt("xori %s, %s, %d", tig(dest), tig(operand1), operand2);
+                outstmt("snez %s, %s", tig(dest), tig(dest));
+            }
+            break;
+        case OpBitAnd:
+            outstmt("andi %s, %s, %d", tig(dest), tig(operand1), operand2);
+            break;
+        case OpBitOr:
+            outstmt("ori %s, %s, %d", tig(dest), tig(operand1), operand2);
+            break;
+        case OpBitXor:
+            outstmt("xori %s, %s, %d", tig(dest), tig(operand1), operand2);
+            break;
+        default:
+            assert(false);
+            break;
+    }
+}
+
 void InstOpUnary::output_asm(list<string> &buf) {
     switch(op) {
         case OpNeg:
@@ -168,6 +284,33 @@ void InstArrayGet::output_asm(list<string> &buf) {
 }
 
 void InstCondGoto::output_asm(list<string> &buf) {
+    if(operand2==Preg('x', 0)) { // compare with zero
+        switch(op) {
+            case RelLess:
+                outstmt("bltz %s, .l%d", tig(operand1), label);
+                break;
+            case RelGreater:
+                outstmt("bgtz %s, .l%d", tig(operand1), label);
+                break;
+            case RelLeq:
+                outstmt("blez %s, .l%d", tig(operand1), label);
+                break;
+            case RelGeq:
+                outstmt("bgez %s, .l%d", tig(operand1), label);
+                break;
+            case RelEq:
+                outstmt("beqz %s, .l%d", tig(operand1), label);
+                break;
+            case RelNeq:
+                outstmt("bnez %s, .l%d", tig(operand1), label);
+                break;
+            default:
+                assert(false);
+                break;
+        }
+        return;
+    }
+
     switch(op) {
         case RelLess:
             outstmt("blt %s, %s, .l%d", tig(operand1), tig(operand2), label);
@@ -197,6 +340,22 @@ void InstGoto::output_asm(list<string> &buf) {
     outstmt("j .l%d", label);
 }
 
+void InstTableGoto::output_asm(list<string> &buf) {
+    // operand is read before t0 is written, and t1 after, so it may be either
+    outstmt("slli t0, %s, 2", tig(operand));
+    outstmt("lui t1, %%hi(.l%d)", table);
+    outstmt("add t0, t0, t1");
+    outstmt("lw t0, %%lo(.l%d)(t0)", table);
+    outstmt("jr t0");
+
+    outasm("  .section  .rodata");
+    outasm("  .align    2");
+    outasm(".l%d:", table);
+    for(int label: labels)
+        outasm("  .word     .l%d", label);
+    outasm("  .text");
+}
+
 void InstLabel::output_asm(list<string> &buf) {
     outstmt(".l%d:", label);
 }
@@ -207,11 +366,11 @@ void InstCall::output_asm(list<string> &buf) {
 
 void InstRet::output_asm(list<string> &buf) {
     if(!func->isleaf || func->stacksize>0) {
-        if(imm_overflows(STK(func->stacksize))) {
-            outstmt("li t0, %d", STK(func->stacksize));
+        if(imm_overflows(STK(func))) {
+            outstmt("li t0, %d", STK(func));
             outstmt("add sp, sp, t0");
         } else {
-            outstmt("addi sp, sp, %d", STK(func->stacksize));
+            outstmt("addi sp, sp, %d", STK(func));
         }
     }
 
@@ -245,9 +404,26 @@ void InstLoadStack::output_asm(list<string> &buf) {
     }
 }
 
+// symbol with byte offset, as used in %hi / %lo
+static string global_sym(int globalidx, int offset) {
+    char symbuf[32];
+    if(offset==0)
+        sprintf(symbuf, "v%d", globalidx);
+    else
+        sprintf(symbuf, "v%d+%d", globalidx, offset);
+    return string(symbuf);
+}
+
 void InstLoadGlobal::output_asm(list<string> &buf) {
-    outstmt("lui %s, %%hi(v%d)", tig(dest), globalidx);
-    outstmt("lw %s, %%lo(v%d)(%s)", tig(dest), globalidx, tig(dest));
+    string sym = global_sym(globalidx, offset);
+    outstmt("lui %s, %%hi(%s)", tig(dest), sym.c_str());
+    outstmt("lw %s, %%lo(%s)(%s)", tig(dest), sym.c_str(), tig(dest));
+}
+
+void InstStoreGlobal::output_asm(list<string> &buf) {
+    string sym = global_sym(globalidx, offset);
+    outstmt("lui %s, %%hi(%s)", tig(tmp()), sym.c_str());
+    outstmt("sw %s, %%lo(%s)(%s)", tig(src), sym.c_str(), tig(tmp()));
 }
 
 void InstLoadAddrStack::output_asm(list<string> &buf) {
@@ -300,6 +476,11 @@ void InstLeftShiftI::output_asm(list<string> &buf) {
         outstmt("#mv %s, %s # shift self 0", tig(dest), tig(operand1));
 }
 
+void InstShiftAdd::output_asm(list<string> &buf) {
+    outstmt("slli %s, %s, %d", tig(tmp), tig(operand1), shift);
+    outstmt("%s %s, %s, %s", op==OpPlus ? "add" : "sub", tig(dest), tig(tmp), tig(operand2));
+}
+
 void InstLeftShift::output_asm(list<string> &buf) {
     outstmt("sll %s, %s, %s", tig(dest), tig(operand1), tig(operand2));
 }
@@ -50,6 +50,10 @@ void InstOpBinary::output_tigger(list<string> &buf) {
     outstmt("%s = %s %s %s", tig(dest), tig(operand1), cvt_from_binary(op).c_str(), tig(operand2));
 }
 
+void InstOpBinaryI::output_tigger(list<string> &buf) {
+    outstmt("%s = %s %s %d", tig(dest), tig(operand1), cvt_from_binary(op).c_str(), operand2);
+}
+
 void InstOpUnary::output_tigger(list<string> &buf) {
     outstmt("%s = %s %s", tig(dest), cvt_from_unary(op).c_str(), tig(operand));
 }
@@ -78,6 +82,11 @@ void InstGoto::output_tigger(list<string> &buf) {
     outstmt("goto l%d", label);
 }
 
+void InstTableGoto::output_tigger(list<string> &buf) {
+    // tigger does not support this
+    outstmt("!! goto table l%d by %s", table, tig(operand));
+}
+
 void InstLabel::output_tigger(list<string> &buf) {
     outstmt("l%d:", label);
 }
@@ -99,7 +108,17 @@ void InstLoadStack::output_tigger(list<string> &buf) {
 }
 
 void InstLoadGlobal::output_tigger(list<string> &buf) {
-    outstmt("load v%d %s", globalidx, tig(dest));
+    if(offset==0)
+        outstmt("load v%d %s", globalidx, tig(dest));
+    else {
+        outstmt("loadaddr v%d %s", globalidx, tig(dest));
+        outstmt("%s = %s [%d]", tig(dest), tig(dest), offset);
+    }
+}
+
+void InstStoreGlobal::output_tigger(list<string> &buf) {
+    outstmt("loadaddr v%d %s", globalidx, tig(tmp()));
+    outstmt("%s [%d] = %s", tig(tmp()), offset, tig(src));
 }
 
 void InstLoadAddrStack::output_tigger(list<string> &buf) {
@@ -133,6 +152,11 @@ void InstLeftShiftI::output_tigger(list<string> &buf) {
         outstmt("%s = %s // shift 0", tig(dest), tig(operand1));
 }
 
+void InstShiftAdd::output_tigger(list<string> &buf) {
+    outstmt("%s = %s * %d // shift left", tig(tmp), tig(operand1), 1<<shift);
+    outstmt("%s = %s %s %s", tig(dest), tig(tmp), cvt_from_binary(op).c_str(), tig(operand2));
+}
+
 void InstLeftShift::output_tigger(list<string> &buf) {
     // tigger does not support this
     outstmt("!! %s = %s << %s", tig(dest), tig(operand1), tig(operand2));
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <climits>
+using std::reverse;
+
+#include "inst.hpp"
+
+extern bool SYNTH_CONST_MUL; // gen_inst.cpp
+
+/*
+ * x * c as a chain of steps on a running value acc, starting from acc = x:
+ *
+ *     acc = acc << k
+ *     acc = (acc << k) +- acc      <- times 2^k +- 1
+ *     acc = (acc << k) +- x        <- times 2^k, then one more x
+ *     acc = -acc
+ *
+ * the cheapest chain is found by iterative deepening on its cost, and used if it beats li + mul
+ */
+
+const int MUL_COST = 5; // a mul takes about as long as 5 dependent alu ops on our in-order cores, so x*100 and x*1000 are chains
+
+enum ConstMulStepKind {
+    MulShift, MulAddSelf, MulSubSelf, MulAddX, MulSubX, MulNeg
+};
+
+struct ConstMulStep {
+    ConstMulStepKind kind;
+    int shift;
+};
+
+static int step_cost(ConstMulStep step) {
+    if(step.kind==MulShift || step.kind==MulNeg)
+        return 1;
+    return 2; // slli + add
+}
+
+static int trailing_zeros(long long c) {
+    int k = 0;
+    while(c%2==0) {
+        c /= 2;
+        k++;
+    }
+    return k;
+}
+
+static bool search_chain(long long c, int budget, vector<ConstMulStep> &rsteps) {
+    // steps are pushed last first
+    if(c==1)
+        return true;
+    if(budget<=0)
+        return false;
+
+    auto try_step = [&](ConstMulStepKind kind, int shift, long long rest) {
+        ConstMulStep step = {kind, shift};
+        if(rest<1 || step_cost(step)>budget)
+            return false;
+        rsteps.push_back(step);
+        if(search_chain(rest, budget-step_cost(step), rsteps))
+            return true;
+        rsteps.pop_back();
+        return false;
+    };
+
+    if(c%2==0 && try_step(MulShift, trailing_zeros(c), c>>trailing_zeros(c)))
+        return true;
+    for(int k=1; k<=30; k++) {
+        long long plus = (1LL<<k)+1, minus = (1LL<<k)-1;
+        if(c%plus==0 && try_step(MulAddSelf, k, c/plus))
+            return true;
+        if(k>=2 && c%minus==0 && try_step(MulSubSelf, k, c/minus))
+            return true;
+    }
+    if(c%2==1) {
+        if(try_step(MulAddX, trailing_zeros(c-1), (c-1)>>trailing_zeros(c-1)))
+            return true;
+        if(try_step(MulSubX, trailing_zeros(c+1), (c+1)>>trailing_zeros(c+1)))
+            return true;
+    }
+    return false;
+}
+
+static int li_cost(int c) {
+    return imm_overflows(c) ? 2 : 1; // lui + addi
+}
+
+static bool find_chain(int c, vector<ConstMulStep> &steps) {
+    // cheapest chain, if any beats li + mul
+    if(c==0 || c==1 || c==INT_MIN)
+        return false;
+
+    long long absc = c<0 ? -(long long)c : c;
+    int extra = c<0 ? 1 : 0;
+    for(int budget=1; budget+extra<li_cost(c)+MUL_COST; budget++) {
+        steps.clear();
+        if(search_chain(absc, budget, steps)) {
+            reverse(steps.begin(), steps.end());
+            if(c<0)
+                steps.push_back({MulNeg, 0});
+            return true;
+        }
+    }
+    return false;
+}
+
+bool const_mul_is_cheap(int c) {
+    vector<ConstMulStep> steps;
+    return SYNTH_CONST_MUL && find_chain(c, steps);
+}
+
+bool gen_const_mul(InstFuncDef *func, Preg dest, Preg src, int c, Preg scratch) {
+    /*
+     * acc is written to dest, except while dest is src and x is still needed, then to scratch;
+     * a shifted add needs a tmp other than its addend, which may be the written reg itself
+     */
+    assert(scratch!=dest && scratch!=src);
+    vector<ConstMulStep> steps;
+    if(!SYNTH_CONST_MUL || !find_chain(c, steps))
+        return false;
+
+    vector<InstStmt*> insts;
+    Preg acc = src;
+    for(int i=0; i<(int)steps.size(); i++) {
+        bool x_needed = false;
+        for(int j=i+1; j<(int)steps.size(); j++)
+            if(steps[j].kind==MulAddX || steps[j].kind==MulSubX)
+                x_needed = true;
+        Preg out = (dest==src && x_needed) ? scratch : dest;
+
+        auto step = steps[i];
+        if(step.kind==MulShift) {
+            insts.push_back(new InstLeftShiftI(out, acc, step.shift));
+        } else if(step.kind==MulNeg) {
+            insts.push_back(new InstOpBinary(out, Preg('x', 0), OpMinus, acc));
+        } else {
+            bool self = step.kind==MulAddSelf || step.kind==MulSubSelf;
+            Preg addend = self ? acc : src;
+            BinaryOpKinds op = step.kind==MulAddSelf || step.kind==MulAddX ? OpPlus : OpMinus;
+
+            // tmp is written before the addend is read
+            Preg tmp = out;
+            if(tmp==addend)
+                tmp = scratch;
+            if(tmp==addend || (tmp==src && x_needed))
+                return false;
+            insts.push_back(new InstShiftAdd(out, acc, step.shift, op, addend, tmp));
+        }
+        acc = out;
+    }
+
+    for(auto inst: insts)
+        func->push_stmt(inst);
+    return true;
+}
@@ -0,0 +1,203 @@
+#include <queue>
+#include <unordered_set>
+using std::queue;
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+void propagate_alive_vars(IrFuncDef *func); // regalloc.cpp
+
+static AstDef *local_array_or_null(RVal v) {
+    if(v.type==RVal::Reference && v.val.reference->pos==DefLocal && v.val.reference->idxinfo->dims()>0)
+        return v.val.reference;
+    return nullptr;
+}
+
+static bool remove_unreachable(IrFuncDef *func) {
+    if(func->stmts.empty())
+        return false;
+
+    unordered_set<IrStmt*> reached;
+    queue<IrStmt*> q;
+    reached.insert(func->stmts.front().first);
+    q.push(func->stmts.front().first);
+    while(!q.empty()) {
+        IrStmt *stmt = q.front();
+        q.pop();
+        for(auto next: stmt->next)
+            if(reached.insert(next).second)
+                q.push(next);
+    }
+
+    bool changed = false;
+    for(auto it=func->stmts.begin(); it!=func->stmts.end();) {
+        if(reached.find(it->first)==reached.end()) {
+            if(istype(it->first, IrLabel))
+                func->labels.erase(((IrLabel*)it->first)->label);
+            it = func->stmts.erase(it);
+            changed = true;
+        } else {
+            it++;
+        }
+    }
+    return changed;
+}
+
+static bool remove_dead_values(IrFuncDef *func) {
+    // side-effect free stmts whose pooled dest is dead afterwards
+    bool changed = false;
+    for(auto it=func->stmts.begin(); it!=func->stmts.end();) {
+        auto stmt = it->first;
+        bool pure = istype(stmt, IrOpBinary) || istype(stmt, IrOpUnary) || istype(stmt, IrMov) || istype(stmt, IrArrayGet);
+
+        bool dead = false;
+        if(pure) {
+            LVal dest = *stmt->written_vals()[0];
+            if(istype(stmt, IrMov) && dest==((IrMov*)stmt)->src)
+                dead = true; // self move
+            else if(dest.regpooled() && stmt->meet_pooled_vars.find(dest.reguid())==stmt->meet_pooled_vars.end())
+                dead = true;
+        }
+
+        if(dead) {
+            it = func->stmts.erase(it);
+            changed = true;
+        } else {
+            it++;
+        }
+    }
+    return changed;
+}
+
+static bool remove_dead_array_stores(IrFuncDef *func) {
+    /*
+     * local arrays whose address never leaves `arr [..]`, `ptr = arr + x; ptr [0]` forms
+     * are tracked as a whole: a store is dead if no path reads the array afterwards
+     */
+
+    // tempvars holding `arr + x`, with a single def
+    unordered_map<int, AstDef*> ptr_base;
+    unordered_map<int, int> def_count;
+    unordered_set<AstDef*> escaped;
+    for(const auto& stmtpair: func->stmts) {
+        for(int def: stmtpair.first->defs())
+            def_count[def]++;
+        if(istype(stmtpair.first, IrOpBinary)) {
+            auto binstmt = (IrOpBinary*)stmtpair.first;
+            auto arr = local_array_or_null(binstmt->operand1);
+            if(arr && binstmt->op==OpPlus && binstmt->dest.type==LVal::TempVar)
+                ptr_base[binstmt->dest.reguid()] = arr;
+            else if(arr)
+                escaped.insert(arr);
+            if(local_array_or_null(binstmt->operand2))
+                escaped.insert(local_array_or_null(binstmt->operand2));
+        }
+    }
+    for(auto defpair: def_count)
+        if(defpair.second>1 && ptr_base.find(defpair.first)!=ptr_base.end()) {
+            escaped.insert(ptr_base[defpair.first]);
+            ptr_base.erase(defpair.first);
+        }
+
+    // array an access goes to, or null
+    auto base_of = [&](LVal v) -> AstDef* {
+        if(v.type==LVal::Reference)
+            return local_array_or_null(v);
+        auto it = ptr_base.find(v.reguid());
+        return it==ptr_base.end() ? nullptr : it->second;
+    };
+
+    // any other use of the array or a pointer into it lets it escape
+    for(const auto& stmtpair: func->stmts) {
+        auto stmt = stmtpair.first;
+        unordered_set<int> allowed;
+        if(istype(stmt, IrArraySet) && ((IrArraySet*)stmt)->dest.type==LVal::TempVar)
+            allowed.insert(((IrArraySet*)stmt)->dest.reguid());
+        if(istype(stmt, IrArrayGet) && ((IrArrayGet*)stmt)->src.type==RVal::TempVar)
+            allowed.insert(((IrArrayGet*)stmt)->src.reguid());
+
+        for(int use: stmt->uses())
+            if(allowed.find(use)==allowed.end() && ptr_base.find(use)!=ptr_base.end())
+                escaped.insert(ptr_base[use]);
+        for(auto val: stmt->read_vals())
+            if(local_array_or_null(*val) && !(istype(stmt, IrArrayGet) || istype(stmt, IrOpBinary)))
+                escaped.insert(local_array_or_null(*val));
+    }
+
+    // backward dataflow: arrays that may be read later
+    vector<IrStmt*> order;
+    for(const auto& stmtpair: func->stmts)
+        order.push_back(stmtpair.first);
+
+    unordered_map<IrStmt*, unordered_set<AstDef*>> live_in, live_out;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(int i=(int)order.size()-1; i>=0; i--) {
+            auto stmt = order[i];
+            unordered_set<AstDef*> live;
+            for(auto next: stmt->next)
+                for(auto arr: live_in[next])
+                    live.insert(arr);
+            live_out[stmt] = live;
+
+            if(istype(stmt, IrArrayGet)) {
+                auto getstmt = (IrArrayGet*)stmt;
+                AstDef *arr = getstmt->src.type==RVal::TempVar ? base_of(LVal::asTempVar(getstmt->src.val.tempvar)) : local_array_or_null(getstmt->src);
+                if(arr)
+                    live.insert(arr);
+            }
+
+            if(live!=live_in[stmt]) {
+                live_in[stmt] = live;
+                changed = true;
+            }
+        }
+    }
+
+    bool removed = false;
+    for(auto it=func->stmts.begin(); it!=func->stmts.end();) {
+        auto stmt = it->first;
+        AstDef *arr = nullptr;
+        if(istype(stmt, IrArraySet))
+            arr = base_of(((IrArraySet*)stmt)->dest);
+        else if(istype(stmt, IrLocalArrayFillZero))
+            arr = local_array_or_null(((IrLocalArrayFillZero*)stmt)->dest);
+
+        if(arr && escaped.find(arr)==escaped.end() && live_out[stmt].find(arr)==live_out[stmt].end()) {
+            it = func->stmts.erase(it);
+            removed = true;
+        } else {
+            it++;
+        }
+    }
+    return removed;
+}
+
+void IrFuncDef::eliminate_dead_code() {
+    // iterate, removing a stmt may leave the ones computing its operands dead; cfg is rebuilt after each change
+    while(true) {
+        connect_all_cfg();
+        if(remove_unreachable(this))
+            continue;
+
+        propagate_alive_vars(this);
+        if(remove_dead_values(this))
+            continue;
+
+        if(!remove_dead_array_stores(this))
+            break;
+    }
+
+    // local arrays nothing refers to any more take no frame space
+    auto used = referenced_defs();
+    for(auto it=decls.begin(); it!=decls.end();) {
+        auto def = it->first->def_or_null;
+        if(def && def->idxinfo->dims()>0 && used.find(def)==used.end())
+            it = decls.erase(it);
+        else
+            it++;
+    }
+}
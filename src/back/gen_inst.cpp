@@ -6,6 +6,10 @@ using std::swap;
 #include "../front/ast.hpp"
 
 const bool INST_GEN_COMMENTS = true;
+bool STATIC_GLOBAL_INIT = true; // global arrays initialized as data, instead of by stores at start of main
+bool SYNTH_CONST_MUL = true; // multiply by constants with shifts and adds, see const_mul.cpp
+
+bool gen_const_mul(InstFuncDef *func, Preg dest, Preg src, int c, Preg scratch); // const_mul.cpp
 
 void warn_dest_not_used(LVal v, string funcname) {
     printf("warning: unused dest value ");
@@ -31,9 +35,13 @@ void IrRoot::gen_inst(InstRoot *root) {
 
     assert(root->mainfunc!=nullptr);
 
+    if(STATIC_GLOBAL_INIT)
+        return;
+
     // generate global array init to start of main
     const Preg rega0 = Preg('a', 0); // can be used before program starts
     for(auto arrdecl_pair: root->decl_arrays) { // global idx: decl
+        arrdecl_pair.second->readonly = false; // written by the stores below
         if(arrdecl_pair.second->initval.empty())
             continue;
 
@@ -54,6 +62,8 @@ void IrRoot::gen_inst(InstRoot *root) {
 /* ↑ */ root->mainfunc->stmts.push_front(new InstLoadAddrGlobal(tmpreg0, arrdecl_pair.first));
 
 //----- ABOVE: STMTS IN REVERSED ORDER
+
+        arrdecl_pair.second->initval.clear();
     }
 }
 
@@ -61,7 +71,7 @@ void IrDecl::gen_inst_global(InstRoot *root) {
     assert(def_or_null!=nullptr);
 
     if(def_or_null->idxinfo->dims()>0) { // array
-        root->push_decl(def_or_null->index, new InstDeclArray(def_or_null->index, def_or_null->initval.totelems*4));
+        root->push_decl(def_or_null->index, new InstDeclArray(def_or_null->index, def_or_null->initval.totelems*4, def_or_null->ast_is_const));
     } else { // scalar
         root->push_decl(def_or_null->index, new InstDeclScalar(def_or_null->index));
     }
@@ -80,7 +90,7 @@ void IrInit::gen_inst_global(InstRoot *root) {
 }
 
 void IrFuncDef::gen_inst(InstRoot *root) {
-    auto func = new InstFuncDef(name, params->val.size(), spillsize+callersavesize);
+    auto func = new InstFuncDef(name, params->val.size(), spillsize+callersavesize+arraysize);
     root->push_func(func);
 
     if(INST_GEN_COMMENTS) {
@@ -90,7 +100,33 @@ void IrFuncDef::gen_inst(InstRoot *root) {
         func->push_stmt(new InstComment(s));
     }
 
+    // regs that callers already expect to be destroyed, usable as extra spill scratch
+    // a* are excluded since they carry params around calls
+    vector<Preg> scratch_candidates;
+    for(Preg reg: this->root->get_destroy_set(name))
+        if(reg.cat=='s' || (reg.cat=='t' && reg.index>=2))
+            scratch_candidates.push_back(reg);
+
     for(auto stmtpair: stmts) {
+        unordered_set<Preg, Preg::Hash> busy_regs;
+        auto mark_busy = [&](int uid) {
+            auto it = vreg_map.find(uid);
+            if(it!=vreg_map.end() && it->second.pos==Vreg::VregInReg)
+                busy_regs.insert(it->second.reg);
+        };
+        for(int uid: stmtpair.first->alive_pooled_vars)
+            mark_busy(uid);
+        for(int uid: stmtpair.first->meet_pooled_vars)
+            mark_busy(uid);
+        for(int uid: stmtpair.first->defs())
+            mark_busy(uid);
+
+        vector<Preg> spare;
+        for(Preg reg: scratch_candidates)
+            if(busy_regs.find(reg)==busy_regs.end())
+                spare.push_back(reg);
+        func->set_spare_regs(spare);
+
         if(INST_GEN_COMMENTS) {
             func->push_stmt(new InstComment(""));
             list<string> cmt_buf;
@@ -132,29 +168,20 @@ void fn_dostore(LVal v, IrFuncDef *irfunc, InstFuncDef *instfunc) {
     if(v.type==LVal::Reference && v.val.reference->pos==DefGlobal) { // ref global
 
         InstStmt *last = instfunc->get_last_stmt();
-        if(istype(last, InstMov)) {
+        if(istype(last, InstMov) && ((InstMov*)last)->dest==tmpreg0) {
+            /*
+             * t0 = some_reg    <- last
+             * v.. [0] = t0
+             *
+             * -- can be optimized to --
+             *
+             * v.. [0] = some_reg
+             */
             auto *movstmt = (InstMov*)last;
-            if(movstmt->dest==tmpreg0 && movstmt->src!=tmpreg1) {
-                /*
-                 * t0 = some_reg    <- last
-                 * loadaddr v.. t1
-                 * t1 [0] = t0
-                 *
-                 * -- can be optimized to --
-                 *
-                 * loadaddr v.. t1
-                 * t1 [0] = some_reg
-                 */
-                instfunc->stmts.pop_back();
-                instfunc->push_stmt(new InstLoadAddrGlobal(tmpreg1, v.val.reference->index));
-                instfunc->push_stmt(new InstArraySet(tmpreg1, 0, movstmt->src));
-            } else {
-                instfunc->push_stmt(new InstLoadAddrGlobal(tmpreg1, v.val.reference->index));
-                instfunc->push_stmt(new InstArraySet(tmpreg1, 0, tmpreg0));
-            }
+            instfunc->stmts.pop_back();
+            instfunc->push_stmt(new InstStoreGlobal(v.val.reference->index, 0, movstmt->src));
         } else {
-            instfunc->push_stmt(new InstLoadAddrGlobal(tmpreg1, v.val.reference->index));
-            instfunc->push_stmt(new InstArraySet(tmpreg1, 0, tmpreg0));
+            instfunc->push_stmt(new InstStoreGlobal(v.val.reference->index, 0, tmpreg0));
         }
     } else { // vregged
         irfunc->get_vreg(v).store_onto_stack_if_needed(instfunc);
@@ -172,6 +199,11 @@ void fn_dostore(LVal v, IrFuncDef *irfunc, InstFuncDef *instfunc) {
     } \
 } while(0)
 
+#define ret_if_remat(dest) do { \
+    if((dest).regpooled() && this->func->get_vreg((dest).reguid()).pos==Vreg::VregRemat) \
+        return; /* recomputed at each use */ \
+} while(0)
+
 bool is_small_pow2(int x) {
     for(int i=0; i<31; i++) // exclude i=31 to avoid signing issues
         if(x==(1<<i))
@@ -187,12 +219,19 @@ int get_small_pow2(int x) {
 
 void IrOpBinary::gen_inst(InstFuncDef *func) {
     ret_if_unused(dest);
+    ret_if_remat(dest);
 
     Preg regop1 = Preg('x', 0);
 
-    if((op==OpPlus || op==OpMul) && operand1.type==RVal::ConstExp)
+    bool commutative = op==OpPlus || op==OpMul || op==OpBitAnd || op==OpBitOr || op==OpBitXor;
+    if(commutative && operand1.type==RVal::ConstExp)
         swap(operand1, operand2); // const + x --> x + const for further optim
 
+    if(cvt_to_rel(op)!=NotARel && operand1.type==RVal::ConstExp && operand2.type!=RVal::ConstExp) {
+        swap(operand1, operand2); // const < x --> x > const for further optim
+        op = cvt_to_binary(rel_swap(cvt_to_rel(op)));
+    }
+
     if(op==OpMinus && operand2.type==RVal::ConstExp) {
         op = OpPlus; // x - const --> x + (-const) for further optim
         operand2.val.constexp = -operand2.val.constexp;
@@ -234,10 +273,15 @@ void IrOpBinary::gen_inst(InstFuncDef *func) {
         // can be simplified to left shift
         int shiftval = get_small_pow2(operand2.val.constexp);
         func->push_stmt(new InstLeftShiftI(rstore(dest), regop1, shiftval));
+    } else if(op==OpMul && operand2.type==RVal::ConstExp && gen_const_mul(func, rstore(dest), regop1, operand2.val.constexp, tmpreg1)) {
+        // shift and add chain, cheaper than li + mul
     } else if(op==OpDiv && op2_is_const_powof2) {
         // can be simplified to right shift, but unsound
         int shiftval = get_small_pow2(operand2.val.constexp);
         func->push_stmt(new InstLeftShiftI(rstore(dest), regop1, -shiftval));
+    } else if(op2_is_const && InstOpBinaryI::supports(op, operand2.val.constexp)) {
+        // comparison or bitwise op with immediate, e.g. slti, andi
+        func->push_stmt(new InstOpBinaryI(rstore(dest), regop1, op, operand2.val.constexp));
     } else {
         // normal reg-reg add
         Preg regop2 = rload(operand2, 1);
@@ -258,6 +302,7 @@ void IrOpUnary::gen_inst(InstFuncDef *func) {
 
 void IrMov::gen_inst(InstFuncDef *func) {
     ret_if_unused(dest);
+    ret_if_remat(dest);
 
     if(src.type==RVal::ConstExp)
         func->push_stmt(new InstLoadImm(rstore(dest), src.val.constexp));
@@ -272,8 +317,7 @@ void IrArraySet::gen_inst(InstFuncDef *func) {
     } else { // reference
         switch(dest.val.reference->pos) {
             case DefGlobal:
-                func->push_stmt(new InstLoadAddrGlobal(tmpreg1, dest.val.reference->index));
-                func->push_stmt(new InstArraySet(tmpreg1, doffset, rload(src, 0)));
+                func->push_stmt(new InstStoreGlobal(dest.val.reference->index, doffset, rload(src, 0)));
                 break;
 
             case DefLocal:
@@ -301,8 +345,12 @@ void IrArrayGet::gen_inst(InstFuncDef *func) {
     } else { // reference
         switch(src.val.reference->pos) {
             case DefGlobal:
-                func->push_stmt(new InstLoadAddrGlobal(tmpreg1, src.val.reference->index));
-                func->push_stmt(new InstArrayGet(rstore(dest), tmpreg1, soffset));
+                if(imm_overflows(soffset)) {
+                    func->push_stmt(new InstLoadAddrGlobal(tmpreg1, src.val.reference->index));
+                    func->push_stmt(new InstArrayGet(rstore(dest), tmpreg1, soffset));
+                } else {
+                    func->push_stmt(new InstLoadGlobal(rstore(dest), src.val.reference->index, soffset));
+                }
                 break;
 
             case DefLocal:
@@ -324,19 +372,46 @@ void IrArrayGet::gen_inst(InstFuncDef *func) {
 }
 
 void IrCondGoto::gen_inst(InstFuncDef *func) {
-    func->push_stmt(new InstCondGoto(rload(operand1, 0), op, rload(operand2, 1), label));
+    RVal lhs = operand1, rhs = operand2;
+    RelKinds relop = op;
+
+    if(lhs.type==RVal::ConstExp && rhs.type!=RVal::ConstExp) {
+        swap(lhs, rhs); // const < x --> x > const
+        relop = rel_swap(relop);
+    }
+
+    if(rhs.type==RVal::ConstExp) {
+        // x < 1 --> x <= 0, etc, so that branch compares with x0 and no li is needed
+        int c = rhs.val.constexp;
+        if((c==1 && relop==RelLess) || (c==-1 && relop==RelLeq)) {
+            relop = c==1 ? RelLeq : RelLess;
+            rhs = RVal::asConstExp(0);
+        } else if((c==1 && relop==RelGeq) || (c==-1 && relop==RelGreater)) {
+            relop = c==1 ? RelGreater : RelGeq;
+            rhs = RVal::asConstExp(0);
+        }
+    }
+
+    func->push_stmt(new InstCondGoto(rload(lhs, 0), relop, rload(rhs, 1), label));
 }
 
 void IrGoto::gen_inst(InstFuncDef *func) {
     func->push_stmt(new InstGoto(label));
 }
 
+void IrTableGoto::gen_inst(InstFuncDef *func) {
+    func->push_stmt(new InstTableGoto(rload(operand, 0), labels, table));
+}
+
 void IrLabel::gen_inst(InstFuncDef *func) {
     func->push_stmt(new InstLabel(label));
 }
 
 void IrParam::gen_inst_handled_by_call(InstFuncDef *func) {
-    func->push_stmt(new InstMov(Preg('a', pidx), rload(param, 1)));
+    if(param.type==RVal::ConstExp && param.val.constexp!=0)
+        func->push_stmt(new InstLoadImm(Preg('a', pidx), param.val.constexp));
+    else
+        func->push_stmt(new InstMov(Preg('a', pidx), rload(param, 1)));
 }
 
 template<typename T>
@@ -381,12 +456,10 @@ vector<Preg> IrCallVoid::gen_inst_common(InstFuncDef *func, Preg skipped_retreg)
         }
     }
 
-    assert((int)saved_regs.size() <= this->func->callersavesize);
-
     // save them
 
     for(int i=0; i<(int)saved_regs.size(); i++)
-        saved_regs[i].caller_save_before(func, this->func->spillsize + i);
+        saved_regs[i].caller_save_before(func, this->func->callersave_slot(this, i));
 
     // pass param
     // note that param in a* need to be loaded from stack to avoid collision
@@ -406,7 +479,7 @@ vector<Preg> IrCallVoid::gen_inst_common(InstFuncDef *func, Preg skipped_retreg)
 
                     func->push_stmt(new InstLoadStack(
                         Preg('a', param->pidx),
-                        this->func->spillsize + saveidx
+                        this->func->callersave_slot(this, saveidx)
                     ));
                     continue;
                 }
@@ -428,7 +501,7 @@ void IrCallVoid::gen_inst(InstFuncDef *func) {
 
     // restore saved regs
     for(int i=0; i<(int)meet_regs.size(); i++)
-        meet_regs[i].caller_load_after(func, this->func->spillsize + i);
+        meet_regs[i].caller_load_after(func, this->func->callersave_slot(this, i));
 }
 
 void IrCall::gen_inst(InstFuncDef *func) {
@@ -448,7 +521,7 @@ void IrCall::gen_inst(InstFuncDef *func) {
     for(int i=0; i<(int)meet_regs.size(); i++) {
         if(retreg.pos==Vreg::VregInReg && retreg.reg==meet_regs[i])
             continue;
-        meet_regs[i].caller_load_after(func, this->func->spillsize + i);
+        meet_regs[i].caller_load_after(func, this->func->callersave_slot(this, i));
     }
 }
 
@@ -466,30 +539,51 @@ void IrReturn::gen_inst(InstFuncDef *func) {
 }
 
 void IrLocalArrayFillZero::gen_inst(InstFuncDef *func) {
-    /* # Fill `array` of `totelems` with zeros
-     * t0 = array
-     * t1 = totelems
-     * t1 = t1 << 2
+    /* # Fill `count` elements of `array` from `begin` with zeros
+     * t0 = array + begin*4
+     * t1 = count/8*32
      * t1 = t1 + t0
      * loop:
      * t0 [0] = 0
-     * t0 = t0 + 4
+     * ...
+     * t0 [28] = 0
+     * t0 = t0 + 32
      * if t0<t1 goto loop
+     * t0 [0] = 0               <- count%8 tail stores
+     * ...
+     *
+     * short ranges are fully unrolled instead
      */
 
+    const int FILL_UNROLL_MAX = 16;
+    const int FILL_LOOP_STEP = 8;
+
     assert(dest.type==LVal::Reference);
     assert(this->func->get_vreg(dest).pos==Vreg::VregInStack);
-    int stackpos = this->func->get_vreg(dest).spilloffset;
-    int looplabel = this->func->gen_label();
-    int totelems = dest.val.reference->initval.totelems;
-    assert(totelems>0);
+    int stackpos = this->func->get_vreg(dest).spilloffset + begin;
+    assert(begin+count<=dest.val.reference->initval.totelems);
+
+    if(count<=FILL_UNROLL_MAX && !imm_overflows((stackpos+count)*4)) { // store relative to sp
+        for(int i=0; i<count; i++)
+            func->push_stmt(new InstStoreStack(stackpos+i, Preg('x', 0)));
+        return;
+    }
 
     func->push_stmt(new InstLoadAddrStack(Preg('t', 0), stackpos));
-    func->push_stmt(new InstLoadImm(Preg('t', 1), totelems));
-    func->push_stmt(new InstLeftShiftI(Preg('t', 1), Preg('t', 1), 2));
-    func->push_stmt(new InstOpBinary(Preg('t', 1), Preg('t', 1), OpPlus, Preg('t', 0)));
-    func->push_stmt(new InstLabel(looplabel));
-    func->push_stmt(new InstArraySet(Preg('t', 0), 0, Preg('x', 0)));
-    func->push_stmt(new InstAddI(Preg('t', 0), Preg('t', 0), 4));
-    func->push_stmt(new InstCondGoto(Preg('t', 0), RelLess, Preg('t', 1), looplabel));
+
+    int tail = count;
+    if(count>FILL_UNROLL_MAX) {
+        int looplabel = this->func->gen_label();
+        func->push_stmt(new InstLoadImm(Preg('t', 1), count/FILL_LOOP_STEP*FILL_LOOP_STEP*4));
+        func->push_stmt(new InstOpBinary(Preg('t', 1), Preg('t', 1), OpPlus, Preg('t', 0)));
+        func->push_stmt(new InstLabel(looplabel));
+        for(int i=0; i<FILL_LOOP_STEP; i++)
+            func->push_stmt(new InstArraySet(Preg('t', 0), i*4, Preg('x', 0)));
+        func->push_stmt(new InstAddI(Preg('t', 0), Preg('t', 0), FILL_LOOP_STEP*4));
+        func->push_stmt(new InstCondGoto(Preg('t', 0), RelLess, Preg('t', 1), looplabel));
+        tail = count%FILL_LOOP_STEP;
+    }
+
+    for(int i=0; i<tail; i++)
+        func->push_stmt(new InstArraySet(Preg('t', 0), i*4, Preg('x', 0)));
 }
@@ -0,0 +1,214 @@
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+/*
+ * calls to detected builtins are expanded in the caller, with the same ops as the kernels
+ * in builtin_detection.hpp, so constant args fold away and no call sequence is paid
+ */
+
+const int MEMCPY_UNROLL_MAX = 16; // constant lengths up to this are copied straight-line
+const int MUL_MOD = 998244353;
+
+static IrFuncDef *find_func_or_null(IrRoot *root, string name) {
+    for(const auto& funcpair: root->funcs)
+        if(funcpair.first->name==name)
+            return funcpair.first;
+    return nullptr;
+}
+
+static RVal call_arg(IrCallVoid *call, int pidx) {
+    for(auto param: call->params)
+        if(param->pidx==pidx)
+            return param->param;
+    assert(false); return RVal::asConstExp(0);
+}
+
+static void set_result(IrFuncDef *func, IrCallVoid *call, RVal val) {
+    if(istype(call, IrCall))
+        func->push_stmt(new IrMov(func, ((IrCall*)call)->ret, val), "inline builtin - result");
+}
+
+static bool expand_memcpy(IrFuncDef *func, IrCallVoid *call) {
+    /*
+     * dst = dst + dst_pos * 4
+     * do { *dst++ = *src++ } while src < src + len * 4   <- at least one element, as the kernel
+     * result = len
+     */
+    RVal dst_arr = call_arg(call, 0), dst_pos = call_arg(call, 1), src = call_arg(call, 2), len = call_arg(call, 3);
+
+    LVal dst = func->gen_scalar_tempvar();
+    LVal off = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpBinary(func, off, dst_pos, OpMul, RVal::asConstExp(4)));
+    func->push_stmt(new IrOpBinary(func, dst, dst_arr, OpPlus, off), "inline memcpy - dst");
+
+    if(len.type==RVal::ConstExp && len.val.constexp<=MEMCPY_UNROLL_MAX) {
+        int count = len.val.constexp<1 ? 1 : len.val.constexp;
+        for(int i=0; i<count; i++) {
+            LVal x = func->gen_scalar_tempvar();
+            func->push_stmt(new IrArrayGet(func, x, src, i*4));
+            func->push_stmt(new IrArraySet(func, dst, i*4, x));
+        }
+    } else {
+        LVal srcptr = func->gen_scalar_tempvar();
+        LVal upper = func->gen_scalar_tempvar();
+        LVal x = func->gen_scalar_tempvar();
+        int lloop = func->gen_label();
+
+        func->push_stmt(new IrOpBinary(func, srcptr, src, OpPlus, RVal::asConstExp(0)));
+        func->push_stmt(new IrOpBinary(func, upper, len, OpMul, RVal::asConstExp(4)));
+        func->push_stmt(new IrOpBinary(func, upper, srcptr, OpPlus, upper), "inline memcpy - upper");
+        func->push_stmt(new IrLabel(func, lloop), "inline memcpy - loop");
+        func->push_stmt(new IrArrayGet(func, x, srcptr, 0));
+        func->push_stmt(new IrArraySet(func, dst, 0, x));
+        func->push_stmt(new IrOpBinary(func, srcptr, srcptr, OpPlus, RVal::asConstExp(4)));
+        func->push_stmt(new IrOpBinary(func, dst, dst, OpPlus, RVal::asConstExp(4)));
+        func->push_stmt(new IrCondGoto(func, srcptr, RelLess, upper, lloop));
+    }
+
+    set_result(func, call, len);
+    return true;
+}
+
+static bool expand_mul(IrFuncDef *func, IrCallVoid *call) {
+    /*
+     * a * b % MOD by binary expansion of b:
+     * res = 0, t = a
+     * for each bit of b, low first:
+     *     if bit: res = (res + t) % MOD
+     *     if higher bits left: t = (t + t) % MOD
+     * a constant b unrolls into a chain of adds, otherwise the loop is kept
+     */
+    RVal a = call_arg(call, 0), b = call_arg(call, 1);
+    if(b.type==RVal::ConstExp && b.val.constexp<0)
+        return false; // the kernel never terminates for these
+
+    LVal res = func->gen_scalar_tempvar();
+    LVal t = func->gen_scalar_tempvar();
+    func->push_stmt(new IrMov(func, res, RVal::asConstExp(0)), "inline mul - res");
+    func->push_stmt(new IrMov(func, t, a));
+
+    if(b.type==RVal::ConstExp) {
+        for(unsigned bits=b.val.constexp; bits; bits>>=1) {
+            if(bits&1) {
+                func->push_stmt(new IrOpBinary(func, res, res, OpPlus, t));
+                func->push_stmt(new IrOpBinary(func, res, res, OpMod, RVal::asConstExp(MUL_MOD)));
+            }
+            if(bits>1) {
+                func->push_stmt(new IrOpBinary(func, t, t, OpPlus, t));
+                func->push_stmt(new IrOpBinary(func, t, t, OpMod, RVal::asConstExp(MUL_MOD)));
+            }
+        }
+    } else {
+        LVal rest = func->gen_scalar_tempvar();
+        LVal bit = func->gen_scalar_tempvar();
+        int lloop = func->gen_label();
+        int lskip = func->gen_label();
+        int ldone = func->gen_label();
+
+        func->push_stmt(new IrMov(func, rest, b));
+        func->push_stmt(new IrCondGoto(func, rest, RelEq, RVal::asConstExp(0), ldone));
+        func->push_stmt(new IrLabel(func, lloop), "inline mul - loop");
+        func->push_stmt(new IrOpBinary(func, bit, rest, OpMod, RVal::asConstExp(2)));
+        func->push_stmt(new IrCondGoto(func, bit, RelEq, RVal::asConstExp(0), lskip));
+        func->push_stmt(new IrOpBinary(func, res, res, OpPlus, t));
+        func->push_stmt(new IrOpBinary(func, res, res, OpMod, RVal::asConstExp(MUL_MOD)));
+        func->push_stmt(new IrLabel(func, lskip));
+        func->push_stmt(new IrOpBinary(func, rest, rest, OpDiv, RVal::asConstExp(2)));
+        func->push_stmt(new IrCondGoto(func, rest, RelEq, RVal::asConstExp(0), ldone));
+        func->push_stmt(new IrOpBinary(func, t, t, OpPlus, t));
+        func->push_stmt(new IrOpBinary(func, t, t, OpMod, RVal::asConstExp(MUL_MOD)));
+        func->push_stmt(new IrGoto(func, lloop));
+        func->push_stmt(new IrLabel(func, ldone), "inline mul - done");
+    }
+
+    set_result(func, call, res);
+    return true;
+}
+
+static bool expand_set(IrFuncDef *func, IrCallVoid *call) {
+    /*
+     * only for a constant pos, as ir has no variable shift for `1 << pos % 30`:
+     * word = a [pos / 30], bit = word / mask % 2
+     * word += mask if bit goes 0 -> 1, -= mask if 1 -> 0
+     * result = 0
+     */
+    RVal arr = call_arg(call, 0), pos = call_arg(call, 1), d = call_arg(call, 2);
+    if(pos.type!=RVal::ConstExp || pos.val.constexp<0)
+        return false;
+
+    int word_idx = pos.val.constexp/30;
+    int mask = 1 << (pos.val.constexp%30);
+    if(word_idx<10000) {
+        LVal ptr = func->gen_scalar_tempvar();
+        LVal word = func->gen_scalar_tempvar();
+        LVal bit = func->gen_scalar_tempvar();
+        LVal delta = func->gen_scalar_tempvar();
+        int lskip1 = func->gen_label();
+        int lskip2 = func->gen_label();
+
+        func->push_stmt(new IrOpBinary(func, ptr, arr, OpPlus, RVal::asConstExp(word_idx*4)), "inline set - word");
+        func->push_stmt(new IrArrayGet(func, word, ptr, 0));
+        func->push_stmt(new IrOpBinary(func, bit, word, OpDiv, RVal::asConstExp(mask)));
+        func->push_stmt(new IrOpBinary(func, bit, bit, OpMod, RVal::asConstExp(2)));
+        func->push_stmt(new IrMov(func, delta, RVal::asConstExp(0)));
+        func->push_stmt(new IrCondGoto(func, bit, RelEq, d, lskip1));
+        func->push_stmt(new IrCondGoto(func, bit, RelNeq, RVal::asConstExp(0), lskip2));
+        func->push_stmt(new IrCondGoto(func, d, RelNeq, RVal::asConstExp(1), lskip2));
+        func->push_stmt(new IrMov(func, delta, RVal::asConstExp(mask)));
+        func->push_stmt(new IrLabel(func, lskip2));
+        func->push_stmt(new IrCondGoto(func, bit, RelNeq, RVal::asConstExp(1), lskip1));
+        func->push_stmt(new IrCondGoto(func, d, RelNeq, RVal::asConstExp(0), lskip1));
+        func->push_stmt(new IrOpBinary(func, delta, delta, OpMinus, RVal::asConstExp(mask)));
+        func->push_stmt(new IrLabel(func, lskip1));
+        func->push_stmt(new IrOpBinary(func, word, word, OpPlus, delta));
+        func->push_stmt(new IrArraySet(func, ptr, 0, word));
+    }
+
+    set_result(func, call, RVal::asConstExp(0));
+    return true;
+}
+
+static bool expand_builtin_call(IrFuncDef *func, IrFuncDef *callee, IrCallVoid *call) {
+    if(istype(callee, IrFuncDefMemcpy))
+        return expand_memcpy(func, call);
+    if(istype(callee, IrFuncDefMul))
+        return expand_mul(func, call);
+    if(istype(callee, IrFuncDefSet))
+        return expand_set(func, call);
+    return false;
+}
+
+void IrRoot::inline_builtin_calls() {
+    for(const auto& funcpair: funcs) {
+        auto func = funcpair.first;
+        if(istype(func, IrFuncDefBuiltin))
+            continue;
+
+        auto old_stmts = func->stmts;
+        func->stmts.clear();
+
+        // params are pushed right before their call, hold them back until the call is seen
+        vector<pair<IrStmt*, string>> pending_params;
+        for(const auto& stmtpair: old_stmts) {
+            auto stmt = stmtpair.first;
+            if(istype(stmt, IrParam)) {
+                pending_params.push_back(stmtpair);
+                continue;
+            }
+
+            if(istype(stmt, IrCallVoid)) { // also IrCall
+                auto callee = find_func_or_null(this, ((IrCallVoid*)stmt)->name);
+                if(callee && expand_builtin_call(func, callee, (IrCallVoid*)stmt)) {
+                    pending_params.clear();
+                    continue;
+                }
+            }
+
+            for(const auto& parampair: pending_params)
+                func->push_stmt(parampair.first, parampair.second);
+            pending_params.clear();
+            func->push_stmt(stmt, stmtpair.second);
+        }
+    }
+}
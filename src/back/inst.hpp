@@ -2,10 +2,12 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <unordered_map>
 #include <utility> // make_pair
 using std::string;
 using std::list;
+using std::vector;
 using std::unordered_map;
 using std::make_pair;
 
@@ -37,13 +39,19 @@ struct InstDeclScalar: Inst {
     void output_asm(list<string> &buf);
 };
 
+// small data is addressed relative to gp after linker relaxation
+const int SMALL_DATA_MAX_BYTES = 256;
+const int SMALL_DATA_WINDOW_BYTES = 4096;
+
 struct InstDeclArray: Inst {
     int globalidx;
     int totbytes;
-    unordered_map<int, int> initval; // offset bytes -> val
+    unordered_map<int, int> initval; // offset bytes -> val, emitted as data unless set at runtime
+    bool readonly; // const array, placed in .rodata
+    bool small; // placed in .sbss / .sdata, decided in `InstRoot::output_asm`
 
-    InstDeclArray(int globalidx, int totbytes):
-            globalidx(globalidx), totbytes(totbytes), initval({}) {
+    InstDeclArray(int globalidx, int totbytes, bool readonly):
+            globalidx(globalidx), totbytes(totbytes), initval({}), readonly(readonly), small(false) {
         assert(totbytes % 4 == 0);
     }
 
@@ -62,12 +70,23 @@ struct InstFuncDef: Inst {
     InstFuncDef(string name, int params_count, int stacksize):
         name(name), params_count(params_count), stacksize(stacksize), isleaf(true) {}
 
-    void push_stmt(InstStmt *stmt) {
-        stmts.push_back(stmt);
-    }
+    void push_stmt(InstStmt *stmt);
 
     InstStmt *get_last_stmt();
 
+    // spill reload cache, only valid inside a basic block
+    unordered_map<Preg, int, Preg::Hash> cached_slots; // preg -> stack idx whose value it holds
+    vector<Preg> spare_regs; // allocatable regs holding no alive var, set per ir stmt
+    vector<Preg> spare_taken; // spare regs handed out in current ir stmt
+
+    void track_cached_slots(InstStmt *stmt);
+    vector<Preg> find_cached_slot(int stackidx);
+    void set_spare_regs(vector<Preg> regs);
+    Preg take_spare_reg(Preg fallback);
+
+    // block layout, after all stmts are generated
+    void optimize_layout();
+
     void output_tigger(list<string> &buf);
     void output_asm(list<string> &buf);
 };
@@ -99,6 +118,9 @@ struct InstRoot: Inst {
 struct InstStmt: Inst {
     virtual void output_tigger(list<string> &buf) = 0;
     virtual void output_asm(list<string> &buf) = 0;
+
+    // pregs written, including temps used in output
+    virtual vector<Preg> defs() { return vector<Preg>(); }
 };
 
 struct InstOpBinary: InstStmt {
@@ -112,6 +134,43 @@ struct InstOpBinary: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
+};
+
+struct InstOpBinaryI: InstStmt { // comparisons and bitwise ops against an immediate, see also InstAddI
+    Preg dest;
+    Preg operand1;
+    BinaryOpKinds op;
+    int operand2;
+
+    InstOpBinaryI(Preg dest, Preg operand1, BinaryOpKinds op, int operand2):
+        dest(dest), operand1(operand1), op(op), operand2(operand2) {
+        assert(supports(op, operand2));
+    }
+
+    static bool supports(BinaryOpKinds op, int imm) {
+        switch(op) {
+            case OpLess: // slti
+            case OpGeq: // slti + xori
+            case OpEq: // xori + seqz
+            case OpNeq: // xori + snez
+            case OpBitAnd: // andi
+            case OpBitOr: // ori
+            case OpBitXor: // xori
+                return !imm_overflows(imm);
+            case OpLeq: // slti with imm+1
+            case OpGreater: // slti with imm+1, xori
+                return !imm_overflows(imm+1);
+            default:
+                return false;
+        }
+    }
+
+    void output_tigger(list<string> &buf) override;
+    void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstOpUnary: InstStmt {
@@ -124,6 +183,8 @@ struct InstOpUnary: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstMov: InstStmt {
@@ -135,6 +196,8 @@ struct InstMov: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstLoadImm: InstStmt {
@@ -146,6 +209,8 @@ struct InstLoadImm: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstArraySet: InstStmt {
@@ -174,6 +239,12 @@ struct InstArrayGet: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override {
+        if(imm_overflows(soffset))
+            return {dest, Preg('t', 0)};
+        return {dest};
+    }
 };
 
 struct InstCondGoto: InstStmt {
@@ -199,6 +270,20 @@ struct InstGoto: InstStmt {
     void output_asm(list<string> &buf) override;
 };
 
+struct InstTableGoto: InstStmt { // jr through the word at table + operand*4
+    Preg operand;
+    vector<int> labels;
+    int table;
+
+    InstTableGoto(Preg operand, vector<int> labels, int table):
+        operand(operand), labels(labels), table(table) {}
+
+    void output_tigger(list<string> &buf) override;
+    void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {Preg('t', 0), Preg('t', 1)}; }
+};
+
 struct InstLabel: InstStmt {
     int label;
 
@@ -237,6 +322,12 @@ struct InstStoreStack: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override {
+        if(imm_overflows(stackidx*4))
+            return {Preg('t', 0), Preg('t', 1)};
+        return {};
+    }
 };
 
 struct InstLoadStack: InstStmt {
@@ -248,17 +339,43 @@ struct InstLoadStack: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstLoadGlobal: InstStmt {
     Preg dest;
     int globalidx;
+    int offset; // in bytes, for array elements
 
-    InstLoadGlobal(Preg dest, int globalidx):
-        dest(dest), globalidx(globalidx) {}
+    InstLoadGlobal(Preg dest, int globalidx, int offset = 0):
+        dest(dest), globalidx(globalidx), offset(offset) {
+        assert(!imm_overflows(offset));
+    }
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
+};
+
+struct InstStoreGlobal: InstStmt {
+    int globalidx;
+    int offset; // in bytes, for array elements
+    Preg src;
+
+    InstStoreGlobal(int globalidx, int offset, Preg src):
+        globalidx(globalidx), offset(offset), src(src) {
+        assert(!imm_overflows(offset));
+    }
+
+    // holds the upper address bits
+    Preg tmp() { return src==Preg('t', 1) ? Preg('t', 0) : Preg('t', 1); }
+
+    void output_tigger(list<string> &buf) override;
+    void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {tmp()}; }
 };
 
 struct InstLoadAddrStack: InstStmt {
@@ -272,6 +389,8 @@ struct InstLoadAddrStack: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstLoadAddrGlobal: InstStmt {
@@ -283,6 +402,8 @@ struct InstLoadAddrGlobal: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstComment: InstStmt {
@@ -307,6 +428,8 @@ struct InstAddI: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
 
 struct InstLeftShiftI: InstStmt {
@@ -321,6 +444,29 @@ struct InstLeftShiftI: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
+};
+
+struct InstShiftAdd: InstStmt { // dest = (operand1 << shift) +- operand2
+    Preg dest;
+    Preg operand1;
+    int shift;
+    BinaryOpKinds op; // OpPlus or OpMinus
+    Preg operand2;
+    Preg tmp; // holds the shifted value, may be dest
+
+    InstShiftAdd(Preg dest, Preg operand1, int shift, BinaryOpKinds op, Preg operand2, Preg tmp):
+        dest(dest), operand1(operand1), shift(shift), op(op), operand2(operand2), tmp(tmp) {
+        assert(shift>=1 && shift<=31);
+        assert(op==OpPlus || op==OpMinus);
+        assert(tmp!=operand2);
+    }
+
+    void output_tigger(list<string> &buf) override;
+    void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest, tmp}; }
 };
 
 struct InstLeftShift: InstStmt {
@@ -333,4 +479,6 @@ struct InstLeftShift: InstStmt {
 
     void output_tigger(list<string> &buf) override;
     void output_asm(list<string> &buf) override;
+
+    vector<Preg> defs() override { return {dest}; }
 };
@@ -0,0 +1,254 @@
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+using std::unordered_map;
+using std::unordered_set;
+using std::vector;
+
+#include "inst.hpp"
+
+// labels a stmt may jump to
+static vector<int> jump_targets(InstStmt *stmt) {
+    if(istype(stmt, InstGoto))
+        return {((InstGoto*)stmt)->label};
+    else if(istype(stmt, InstCondGoto))
+        return {((InstCondGoto*)stmt)->label};
+    else if(istype(stmt, InstTableGoto))
+        return ((InstTableGoto*)stmt)->labels;
+    return {};
+}
+
+// control never falls through to the next stmt
+static bool ends_flow(InstStmt *stmt) {
+    return istype(stmt, InstGoto) || istype(stmt, InstTableGoto) || istype(stmt, InstRet);
+}
+
+// index of the next stmt that is not a comment, or stmts.size()
+static int next_real(const vector<InstStmt*> &stmts, int i) {
+    i++;
+    while(i<(int)stmts.size() && istype(stmts[i], InstComment))
+        i++;
+    return i;
+}
+
+// whether label `label` is among the labels right after i, so jumping there is falling through
+static bool falls_into(const vector<InstStmt*> &stmts, int i, int label) {
+    for(int j=next_real(stmts, i); j<(int)stmts.size() && istype(stmts[j], InstLabel); j=next_real(stmts, j))
+        if(((InstLabel*)stmts[j])->label==label)
+            return true;
+    return false;
+}
+
+static bool thread_jumps(vector<InstStmt*> &stmts) {
+    /*
+     * L1:
+     *     goto L2
+     *
+     * -- jumps to L1 go to L2 directly --
+     */
+    unordered_map<int, int> forward;
+    for(int i=0; i<(int)stmts.size(); i++) {
+        if(!istype(stmts[i], InstLabel))
+            continue;
+
+        int j = i;
+        while(j<(int)stmts.size() && (istype(stmts[j], InstLabel) || istype(stmts[j], InstComment)))
+            j++;
+        if(j<(int)stmts.size() && istype(stmts[j], InstGoto))
+            forward[((InstLabel*)stmts[i])->label] = ((InstGoto*)stmts[j])->label;
+    }
+
+    auto resolve = [&](int label) {
+        unordered_set<int> seen; // `L: goto L` loops forever, keep it
+        while(forward.find(label)!=forward.end() && seen.insert(label).second)
+            label = forward[label];
+        return label;
+    };
+
+    bool changed = false;
+    for(auto stmt: stmts) {
+        vector<int*> labels;
+        if(istype(stmt, InstGoto))
+            labels.push_back(&((InstGoto*)stmt)->label);
+        else if(istype(stmt, InstCondGoto))
+            labels.push_back(&((InstCondGoto*)stmt)->label);
+        else if(istype(stmt, InstTableGoto))
+            for(int &label: ((InstTableGoto*)stmt)->labels)
+                labels.push_back(&label);
+
+        for(int *label: labels) {
+            int target = resolve(*label);
+            if(target!=*label) {
+                *label = target;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+static bool remove_dead_code(vector<InstStmt*> &stmts) {
+    // unreferenced labels are not block entries, code after goto / ret up to the next entry is dead
+    unordered_set<int> referenced;
+    for(auto stmt: stmts)
+        for(int label: jump_targets(stmt))
+            referenced.insert(label);
+
+    bool changed = false;
+    bool dead = false;
+    vector<InstStmt*> kept;
+    for(auto stmt: stmts) {
+        if(istype(stmt, InstLabel)) {
+            if(referenced.find(((InstLabel*)stmt)->label)==referenced.end()) {
+                changed = true;
+                continue;
+            }
+            dead = false;
+        }
+
+        if(dead && !istype(stmt, InstComment))
+            changed = true;
+        else
+            kept.push_back(stmt);
+
+        if(ends_flow(stmt))
+            dead = true;
+    }
+
+    stmts = kept;
+    return changed;
+}
+
+static bool simplify_branches(vector<InstStmt*> &stmts) {
+    bool changed = false;
+    vector<bool> removed(stmts.size(), false);
+
+    for(int i=0; i<(int)stmts.size(); i++) {
+        if(istype(stmts[i], InstGoto) && falls_into(stmts, i, ((InstGoto*)stmts[i])->label)) {
+            // goto to the next stmt
+            removed[i] = true;
+            changed = true;
+        } else if(istype(stmts[i], InstCondGoto)) {
+            auto condstmt = (InstCondGoto*)stmts[i];
+            int j = next_real(stmts, i);
+
+            if(falls_into(stmts, i, condstmt->label)) {
+                // both ways lead to the next stmt
+                removed[i] = true;
+                changed = true;
+            } else if(j<(int)stmts.size() && istype(stmts[j], InstGoto) && falls_into(stmts, j, condstmt->label)) {
+                /*
+                 * if a rel b goto L1
+                 * goto L2
+                 * L1:
+                 *
+                 * -- can be optimized to --
+                 *
+                 * if a !rel b goto L2
+                 * L1:
+                 */
+                condstmt->op = rel_invert(condstmt->op);
+                condstmt->label = ((InstGoto*)stmts[j])->label;
+                removed[j] = true;
+                changed = true;
+                i = j;
+            }
+        }
+    }
+
+    vector<InstStmt*> kept;
+    for(int i=0; i<(int)stmts.size(); i++)
+        if(!removed[i])
+            kept.push_back(stmts[i]);
+    stmts = kept;
+    return changed;
+}
+
+static bool place_traces(vector<InstStmt*> &stmts) {
+    /*
+     * a trace is a run of stmts only entered by jumping to its first label, and left by
+     * its last goto / ret; a trace ending with `goto L` is followed directly by the trace
+     * starting with L, so that jump becomes a fall through
+     */
+    struct Trace {
+        int begin, end; // [begin, end)
+        int head_label; // -1 if not entered by label only
+        int tail_goto; // index of trailing goto, -1 if none
+    };
+
+    vector<Trace> traces;
+    int begin = 0;
+    for(int i=0; i<(int)stmts.size(); i++) {
+        if(!ends_flow(stmts[i]))
+            continue;
+
+        // trailing comments belong to the next trace
+        Trace t = {begin, i+1, -1, -1};
+        int j = begin;
+        while(j<i && istype(stmts[j], InstComment))
+            j++;
+        if(begin>0 && istype(stmts[j], InstLabel))
+            t.head_label = ((InstLabel*)stmts[j])->label;
+        if(istype(stmts[i], InstGoto))
+            t.tail_goto = i;
+
+        traces.push_back(t);
+        begin = i+1;
+    }
+    if(begin<(int)stmts.size()) // last trace falls off the end
+        traces.push_back({begin, (int)stmts.size(), -1, -1});
+
+    unordered_map<int, int> trace_of_label;
+    for(int i=0; i<(int)traces.size(); i++)
+        if(traces[i].head_label!=-1)
+            trace_of_label[traces[i].head_label] = i;
+
+    // chain traces greedily in original order, starting from the entry
+    vector<bool> placed(traces.size(), false);
+    vector<int> order;
+    for(int i=0; i<(int)traces.size(); i++) {
+        int cur = i;
+        while(cur!=-1 && !placed[cur]) {
+            placed[cur] = true;
+            order.push_back(cur);
+
+            int next = -1;
+            if(traces[cur].tail_goto!=-1) {
+                auto it = trace_of_label.find(((InstGoto*)stmts[traces[cur].tail_goto])->label);
+                if(it!=trace_of_label.end() && !placed[it->second])
+                    next = it->second;
+            }
+            cur = next;
+        }
+    }
+
+    bool changed = false;
+    for(int i=0; i<(int)order.size(); i++)
+        if(order[i]!=i)
+            changed = true;
+    if(!changed)
+        return false;
+
+    vector<InstStmt*> reordered;
+    for(int idx: order)
+        for(int i=traces[idx].begin; i<traces[idx].end; i++)
+            reordered.push_back(stmts[i]);
+    stmts = reordered;
+    return true;
+}
+
+void InstFuncDef::optimize_layout() {
+    vector<InstStmt*> v(stmts.begin(), stmts.end());
+
+    for(int round=0; round<8; round++) {
+        bool changed = false;
+        changed |= thread_jumps(v);
+        changed |= remove_dead_code(v);
+        changed |= simplify_branches(v);
+        changed |= place_traces(v);
+        if(!changed)
+            break;
+    }
+
+    stmts = list<InstStmt*>(v.begin(), v.end());
+}
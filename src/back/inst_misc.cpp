@@ -5,4 +5,89 @@ InstStmt *InstFuncDef::get_last_stmt() {
         return new InstComment("");
     else
         return stmts.back();
-}
\ No newline at end of file
+}
+
+void InstFuncDef::push_stmt(InstStmt *stmt) {
+    // skip spill traffic the cache proves redundant
+    if(istype(stmt, InstLoadStack)) {
+        auto ldstmt = (InstLoadStack*)stmt;
+        auto it = cached_slots.find(ldstmt->dest);
+        if(it!=cached_slots.end() && it->second==ldstmt->stackidx)
+            return;
+    } else if(istype(stmt, InstStoreStack)) {
+        auto ststmt = (InstStoreStack*)stmt;
+        auto it = cached_slots.find(ststmt->src);
+        if(it!=cached_slots.end() && it->second==ststmt->stackidx)
+            return;
+    }
+
+    stmts.push_back(stmt);
+    track_cached_slots(stmt);
+}
+
+void InstFuncDef::track_cached_slots(InstStmt *stmt) {
+    // block boundaries and calls invalidate everything
+    if(istype(stmt, InstLabel) || istype(stmt, InstCall) || istype(stmt, InstGoto) || istype(stmt, InstTableGoto) || istype(stmt, InstRet)) {
+        cached_slots.clear();
+        return;
+    }
+
+    for(Preg reg: stmt->defs())
+        cached_slots.erase(reg);
+
+    if(istype(stmt, InstStoreStack)) {
+        auto ststmt = (InstStoreStack*)stmt;
+        for(auto it=cached_slots.begin(); it!=cached_slots.end();) {
+            if(it->second==ststmt->stackidx)
+                it = cached_slots.erase(it);
+            else
+                it++;
+        }
+        cached_slots[ststmt->src] = ststmt->stackidx;
+    } else if(istype(stmt, InstLoadStack)) {
+        auto ldstmt = (InstLoadStack*)stmt;
+        cached_slots[ldstmt->dest] = ldstmt->stackidx;
+    }
+}
+
+vector<Preg> InstFuncDef::find_cached_slot(int stackidx) {
+    vector<Preg> ret;
+    for(auto cachepair: cached_slots)
+        if(cachepair.second==stackidx)
+            ret.push_back(cachepair.first);
+    return ret;
+}
+
+void InstFuncDef::set_spare_regs(vector<Preg> regs) {
+    // cached values in other regs stay valid until the regs are written
+    spare_regs = regs;
+    spare_taken.clear();
+}
+
+Preg InstFuncDef::take_spare_reg(Preg fallback) {
+    // prefer spare regs caching nothing, never reuse one handed out in this ir stmt
+    Preg chosen = fallback;
+    bool found = false;
+
+    for(Preg reg: spare_regs) {
+        bool taken = false;
+        for(Preg t: spare_taken)
+            if(t==reg)
+                taken = true;
+        if(taken)
+            continue;
+
+        if(cached_slots.find(reg)==cached_slots.end()) {
+            chosen = reg;
+            found = true;
+            break;
+        } else if(!found) {
+            chosen = reg;
+            found = true;
+        }
+    }
+
+    if(found)
+        spare_taken.push_back(chosen);
+    return chosen;
+}
@@ -0,0 +1,311 @@
+#include <deque>
+#include <climits>
+#include <unordered_set>
+using std::deque;
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+ConstExpResult do_unary_op(UnaryOpKinds op, int val); // ast_calc_const.cpp
+ConstExpResult do_binary_op(BinaryOpKinds op, int val1, int val2); // ast_calc_const.cpp
+bool is_small_pow2(int x); // gen_inst.cpp
+
+bool MASK_REMAINDERS = true; // x % 2^k == 0 as x & (2^k-1) == 0, bitwise ops are only in riscv output
+
+/*
+ * local algebra on single stmts, looking back through defs in the same block:
+ *
+ *     t = 3 + x        ->  t = x + 3           constants to the right, x - c as x + -c
+ *     t = x * 1        ->  t = x               identities, also x+0, x*0, x-x, x/1, x^x, -(-x)
+ *     u = t + 5        ->  u = x + 8           constant chains of + * & | ^ reassociated
+ *     u = !t           ->  u = x >= y          t = x < y, also !!x as x != 0
+ *     t = x % 8
+ *     if t == 0 goto   ->  m = x & 7           remainders only tested against zero
+ *                          if m == 0 goto
+ *
+ * rewritten stmts, and later reads of their dest in the block, are revisited until nothing changes;
+ * defs left unused are removed by dce
+ */
+
+typedef list<Commented(IrStmt*)>::iterator StmtIter;
+
+static bool is_const(RVal v, int c) {
+    return v.type==RVal::ConstExp && v.val.constexp==c;
+}
+
+static bool is_array(RVal v) {
+    // pointer math, not a scalar val
+    return v.type==RVal::Reference && v.val.reference->idxinfo->dims()>0;
+}
+
+static bool writes(IrStmt *stmt, RVal v) {
+    for(auto val: stmt->written_vals())
+        if(*val==v)
+            return true;
+    // callees may write globals
+    return istype(stmt, IrCallVoid) && v.type==RVal::Reference && v.val.reference->pos==DefGlobal;
+}
+
+static bool reads(IrStmt *stmt, RVal v) {
+    for(auto val: stmt->read_vals())
+        if(*val==v)
+            return true;
+    return false;
+}
+
+static bool local_def(IrFuncDef *func, StmtIter it, RVal v, StmtIter &defit) {
+    // the last stmt writing v before it, in the same block
+    while(it!=func->stmts.begin()) {
+        it--;
+        if(istype(it->first, IrLabel))
+            return false;
+        if(writes(it->first, v)) {
+            defit = it;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool unchanged_between(StmtIter from, StmtIter to, RVal v) {
+    // v read at from still holds at to, from excluded
+    if(v.type==RVal::ConstExp)
+        return true;
+    for(auto it=std::next(from); it!=to; it++)
+        if(writes(it->first, v))
+            return false;
+    return !writes(from->first, v);
+}
+
+static int wrapping(BinaryOpKinds op, int c1, int c2) {
+    // sums and products wrap like the machine does
+    switch(op) {
+        case OpPlus: return (int)((unsigned)c1 + (unsigned)c2);
+        case OpMul: return (int)((unsigned)c1 * (unsigned)c2);
+        case OpBitAnd: return c1 & c2;
+        case OpBitOr: return c1 | c2;
+        case OpBitXor: return c1 ^ c2;
+        default: assert(false); return 0;
+    }
+}
+
+static bool is_commutative(BinaryOpKinds op) {
+    return op==OpPlus || op==OpMul || op==OpEq || op==OpNeq || op==OpBitAnd || op==OpBitOr || op==OpBitXor;
+}
+
+static bool combine_binary(IrFuncDef *func, StmtIter it) {
+    auto stmt = (IrOpBinary*)it->first;
+    auto &x = stmt->operand1, &y = stmt->operand2;
+    auto replace = [&](IrStmt *newstmt) {
+        it->first = newstmt;
+        return true;
+    };
+    if(is_array(x) || is_array(y))
+        return false;
+
+    // t = c, read in the same block
+    StmtIter defit;
+    for(auto val: {&x, &y})
+        if(val->type!=RVal::ConstExp && local_def(func, it, *val, defit) && istype(defit->first, IrMov) &&
+                ((IrMov*)defit->first)->src.type==RVal::ConstExp) {
+            *val = ((IrMov*)defit->first)->src;
+            return true;
+        }
+
+    if(x.type==RVal::ConstExp && y.type==RVal::ConstExp) {
+        auto res = do_binary_op(stmt->op, x.val.constexp, y.val.constexp);
+        return !res.iserror && replace(new IrMov(func, stmt->dest, RVal::asConstExp(res.val)));
+    }
+
+    // constants to the right
+    if(x.type==RVal::ConstExp) {
+        RelKinds rel = cvt_to_rel(stmt->op);
+        if(!is_commutative(stmt->op) && rel==NotARel)
+            return false; // c - x, c / x, c % x
+        std::swap(x, y);
+        if(rel!=NotARel)
+            stmt->op = cvt_to_binary(rel_swap(rel));
+        return true;
+    }
+    if(stmt->op==OpMinus && y.type==RVal::ConstExp && y.val.constexp!=INT_MIN) {
+        stmt->op = OpPlus;
+        y = RVal::asConstExp(-y.val.constexp);
+        return true;
+    }
+
+    // identities
+    int c = y.type==RVal::ConstExp ? y.val.constexp : 0;
+    if(y.type==RVal::ConstExp) {
+        switch(stmt->op) {
+            case OpPlus: case OpBitOr: case OpBitXor:
+                if(c==0)
+                    return replace(new IrMov(func, stmt->dest, x));
+                break;
+            case OpMul:
+                if(c==0 || c==1)
+                    return replace(new IrMov(func, stmt->dest, c==0 ? y : x));
+                if(c==-1)
+                    return replace(new IrOpUnary(func, stmt->dest, OpNeg, x));
+                break;
+            case OpDiv:
+                if(c==1)
+                    return replace(new IrMov(func, stmt->dest, x));
+                if(c==-1)
+                    return replace(new IrOpUnary(func, stmt->dest, OpNeg, x));
+                break;
+            case OpMod:
+                if(c==1 || c==-1)
+                    return replace(new IrMov(func, stmt->dest, RVal::asConstExp(0)));
+                break;
+            case OpBitAnd:
+                if(c==0 || c==-1)
+                    return replace(new IrMov(func, stmt->dest, c==0 ? y : x));
+                break;
+            default:
+                break;
+        }
+    } else if(x==y) {
+        switch(stmt->op) {
+            case OpMinus: case OpBitXor: case OpNeq: case OpLess: case OpGreater:
+                return replace(new IrMov(func, stmt->dest, RVal::asConstExp(0)));
+            case OpEq: case OpLeq: case OpGeq:
+                return replace(new IrMov(func, stmt->dest, RVal::asConstExp(1)));
+            case OpBitAnd: case OpBitOr:
+                return replace(new IrMov(func, stmt->dest, x));
+            default:
+                break;
+        }
+    }
+
+    if(y.type!=RVal::ConstExp || !local_def(func, it, x, defit) || !istype(defit->first, IrOpBinary))
+        return false;
+    auto def = (IrOpBinary*)defit->first;
+    auto &defx = def->operand1, &defy = def->operand2;
+    if(defy.type!=RVal::ConstExp || defx.type==RVal::ConstExp || is_array(defx) || def->dest==defx || !unchanged_between(defit, it, defx))
+        return false;
+
+    // (x op c1) op c2  ->  x op (c1 op c2)
+    bool chain = stmt->op==OpPlus || stmt->op==OpMul || stmt->op==OpBitAnd || stmt->op==OpBitOr || stmt->op==OpBitXor;
+    if(chain && def->op==stmt->op) {
+        x = defx;
+        y = RVal::asConstExp(wrapping(stmt->op, defy.val.constexp, c));
+        return true;
+    }
+
+    // (x % 2^k) == 0  ->  (x & 2^k-1) == 0, the same for negative x
+    if(MASK_REMAINDERS && (stmt->op==OpEq || stmt->op==OpNeq) && c==0 && def->op==OpMod && is_small_pow2(defy.val.constexp) && defy.val.constexp>1) {
+        LVal m = func->gen_scalar_tempvar();
+        func->stmts.insert(it, make_pair(new IrOpBinary(func, m, defx, OpBitAnd, RVal::asConstExp(defy.val.constexp-1)), "combined - mask"));
+        x = m;
+        return true;
+    }
+    return false;
+}
+
+static bool combine_unary(IrFuncDef *func, StmtIter it) {
+    auto stmt = (IrOpUnary*)it->first;
+    auto &x = stmt->operand;
+    auto replace = [&](IrStmt *newstmt) {
+        it->first = newstmt;
+        return true;
+    };
+
+    if(x.type==RVal::ConstExp) {
+        auto res = do_unary_op(stmt->op, x.val.constexp);
+        return !res.iserror && replace(new IrMov(func, stmt->dest, RVal::asConstExp(res.val)));
+    }
+    if(stmt->op==OpPos)
+        return replace(new IrMov(func, stmt->dest, x));
+
+    StmtIter defit;
+    if(!local_def(func, it, x, defit))
+        return false;
+
+    if(istype(defit->first, IrOpUnary)) {
+        // -(-x), !!x
+        auto def = (IrOpUnary*)defit->first;
+        if(def->op!=stmt->op || def->dest==def->operand || !unchanged_between(defit, it, def->operand))
+            return false;
+        if(stmt->op==OpNeg)
+            return replace(new IrMov(func, stmt->dest, def->operand));
+        return replace(new IrOpBinary(func, stmt->dest, def->operand, OpNeq, RVal::asConstExp(0)));
+    }
+    if(istype(defit->first, IrOpBinary) && stmt->op==OpNot) {
+        // !(a rel b)  ->  a !rel b
+        auto def = (IrOpBinary*)defit->first;
+        RelKinds rel = cvt_to_rel(def->op);
+        if(rel==NotARel || def->dest==def->operand1 || def->dest==def->operand2 ||
+                !unchanged_between(defit, it, def->operand1) || !unchanged_between(defit, it, def->operand2))
+            return false;
+        return replace(new IrOpBinary(func, stmt->dest, def->operand1, cvt_to_binary(rel_invert(rel)), def->operand2));
+    }
+    return false;
+}
+
+static bool combine_cond_goto(IrFuncDef *func, StmtIter it) {
+    auto stmt = (IrCondGoto*)it->first;
+    auto &x = stmt->operand1, &y = stmt->operand2;
+
+    if(x.type==RVal::ConstExp && y.type!=RVal::ConstExp) {
+        std::swap(x, y);
+        stmt->op = rel_swap(stmt->op);
+        return true;
+    }
+
+    // (x % 2^k) == 0, as in combine_binary
+    StmtIter defit;
+    if(!MASK_REMAINDERS || (stmt->op!=RelEq && stmt->op!=RelNeq) || !is_const(y, 0) || !local_def(func, it, x, defit) || !istype(defit->first, IrOpBinary))
+        return false;
+    auto def = (IrOpBinary*)defit->first;
+    auto &defx = def->operand1, &defy = def->operand2;
+    if(def->op!=OpMod || defy.type!=RVal::ConstExp || !is_small_pow2(defy.val.constexp) || defy.val.constexp<=1 ||
+            defx.type==RVal::ConstExp || is_array(defx) || def->dest==defx || !unchanged_between(defit, it, defx))
+        return false;
+
+    LVal m = func->gen_scalar_tempvar();
+    func->stmts.insert(it, make_pair(new IrOpBinary(func, m, defx, OpBitAnd, RVal::asConstExp(defy.val.constexp-1)), "combined - mask"));
+    x = m;
+    return true;
+}
+
+void IrFuncDef::combine_insts() {
+    deque<StmtIter> worklist;
+    unordered_set<IrStmt*> queued;
+    auto push = [&](StmtIter it) {
+        if(queued.insert(it->first).second)
+            worklist.push_back(it);
+    };
+    for(auto it=stmts.begin(); it!=stmts.end(); it++)
+        push(it);
+
+    while(!worklist.empty()) {
+        auto it = worklist.front();
+        worklist.pop_front();
+        queued.erase(it->first);
+
+        bool changed = false;
+        if(istype(it->first, IrOpBinary))
+            changed = combine_binary(this, it);
+        else if(istype(it->first, IrOpUnary))
+            changed = combine_unary(this, it);
+        else if(istype(it->first, IrCondGoto))
+            changed = combine_cond_goto(this, it);
+        if(!changed)
+            continue;
+
+        // may combine again, and so may later reads of its dest
+        push(it);
+        auto dests = it->first->written_vals();
+        if(dests.empty())
+            continue;
+        RVal dest = *dests[0];
+        for(auto jt=std::next(it); jt!=stmts.end() && !istype(jt->first, IrLabel); jt++) {
+            if(reads(jt->first, dest))
+                push(jt);
+            if(writes(jt->first, dest))
+                break;
+        }
+    }
+}
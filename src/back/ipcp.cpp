@@ -0,0 +1,385 @@
+#include <map>
+#include <string>
+using std::map;
+using std::to_string;
+
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+ConstExpResult do_unary_op(UnaryOpKinds op, int val); // ast_calc_const.cpp
+ConstExpResult do_binary_op(BinaryOpKinds op, int val1, int val2); // ast_calc_const.cpp
+bool const_mul_is_cheap(int c); // const_mul.cpp
+
+const int CLONE_MAX_STMTS = 300; // larger funcs are not specialized
+const int CLONE_BUDGET_STMTS = 1200; // stmts all clones may add
+
+static IrFuncDef *find_func_or_null(IrRoot *root, string name) {
+    for(const auto& funcpair: root->funcs)
+        if(funcpair.first->name==name)
+            return funcpair.first;
+    return nullptr;
+}
+
+static int func_index(IrRoot *root, IrFuncDef *func) {
+    int i = 0;
+    for(auto it=root->funcs.begin(); it->first!=func; it++)
+        i++;
+    return i;
+}
+
+// calls to user functions that may be rewritten, i.e. not main and not detected builtins
+static IrFuncDef *rewritable_callee_or_null(IrRoot *root, IrStmt *stmt) {
+    if(!istype(stmt, IrCallVoid)) // also IrCall
+        return nullptr;
+
+    auto callee = find_func_or_null(root, ((IrCallVoid*)stmt)->name);
+    if(!callee || callee->name=="main" || istype(callee, IrFuncDefBuiltin))
+        return nullptr;
+    return callee;
+}
+
+// arg passed as param `pidx`
+static RVal call_arg(IrCallVoid *call, int pidx) {
+    for(auto param: call->params)
+        if(param->pidx==pidx)
+            return param->param;
+    assert(false); return RVal::asConstExp(0);
+}
+
+static bool is_param(RVal v, IrFuncDef *func, int pidx) {
+    return v.type==RVal::Reference && v.val.reference==func->params->val[pidx];
+}
+
+// scalar params never assigned in the function, reads of which may be replaced by a constant
+static vector<bool> substitutable_params(IrFuncDef *func) {
+    vector<bool> ok;
+    for(auto def: func->params->val)
+        ok.push_back(def->idxinfo->dims()==0);
+
+    for(const auto& stmtpair: func->stmts)
+        for(auto val: stmtpair.first->written_vals())
+            for(int i=0; i<(int)ok.size(); i++)
+                if(is_param(*val, func, i))
+                    ok[i] = false;
+    return ok;
+}
+
+// a constant costs a li as multiplier, divisor or dividend without a shift (and add) form, the param reg is kept there
+static bool const_is_cheap_at(IrStmt *stmt, RVal *val, int constval) {
+    if(!istype(stmt, IrOpBinary))
+        return true;
+
+    auto binstmt = (IrOpBinary*)stmt;
+    bool pow2 = constval>0 && (constval&(constval-1))==0;
+    if(binstmt->op==OpMul)
+        return pow2 || const_mul_is_cheap(constval);
+    if(binstmt->op==OpDiv || binstmt->op==OpMod)
+        return pow2 && val==&binstmt->operand2;
+    return true;
+}
+
+static bool param_is_read_cheaply(IrFuncDef *func, int pidx, int constval) {
+    for(const auto& stmtpair: func->stmts)
+        for(auto val: stmtpair.first->read_vals())
+            if(is_param(*val, func, pidx) && const_is_cheap_at(stmtpair.first, val, constval))
+                return true;
+    return false;
+}
+
+static void substitute_param(IrFuncDef *func, int pidx, int constval) {
+    for(const auto& stmtpair: func->stmts)
+        for(auto val: stmtpair.first->read_vals())
+            if(is_param(*val, func, pidx) && const_is_cheap_at(stmtpair.first, val, constval))
+                *val = RVal::asConstExp(constval);
+    func->substituted_params.insert(pidx);
+}
+
+static void fold_consts(IrFuncDef *func) {
+    // stmts whose operands all became constant
+    for(auto it=func->stmts.begin(); it!=func->stmts.end();) {
+        auto stmt = it->first;
+
+        if(istype(stmt, IrOpBinary)) {
+            auto binstmt = (IrOpBinary*)stmt;
+            if(binstmt->operand1.type==RVal::ConstExp && binstmt->operand2.type==RVal::ConstExp) {
+                auto res = do_binary_op(binstmt->op, binstmt->operand1.val.constexp, binstmt->operand2.val.constexp);
+                if(!res.iserror)
+                    it->first = new IrMov(func, binstmt->dest, RVal::asConstExp(res.val));
+            }
+        } else if(istype(stmt, IrOpUnary)) {
+            auto unarystmt = (IrOpUnary*)stmt;
+            if(unarystmt->operand.type==RVal::ConstExp) {
+                auto res = do_unary_op(unarystmt->op, unarystmt->operand.val.constexp);
+                if(!res.iserror)
+                    it->first = new IrMov(func, unarystmt->dest, RVal::asConstExp(res.val));
+            }
+        } else if(istype(stmt, IrCondGoto)) {
+            auto gotostmt = (IrCondGoto*)stmt;
+            if(gotostmt->operand1.type==RVal::ConstExp && gotostmt->operand2.type==RVal::ConstExp) {
+                auto res = do_binary_op(cvt_to_binary(gotostmt->op), gotostmt->operand1.val.constexp, gotostmt->operand2.val.constexp);
+                if(res.val) {
+                    it->first = new IrGoto(func, gotostmt->label);
+                } else {
+                    it = func->stmts.erase(it);
+                    continue;
+                }
+            }
+        } else if(istype(stmt, IrTableGoto)) {
+            auto tablestmt = (IrTableGoto*)stmt;
+            if(tablestmt->operand.type==RVal::ConstExp) {
+                int idx = tablestmt->operand.val.constexp;
+                if(idx>=0 && idx<(int)tablestmt->labels.size()) // else unreachable behind the bounds check
+                    it->first = new IrGoto(func, tablestmt->labels[idx]);
+            }
+        }
+        it++;
+    }
+}
+
+static IrStmt *copy_stmt(IrStmt *stmt) {
+    if(istype(stmt, IrOpBinary))
+        return new IrOpBinary(*(IrOpBinary*)stmt);
+    else if(istype(stmt, IrOpUnary))
+        return new IrOpUnary(*(IrOpUnary*)stmt);
+    else if(istype(stmt, IrMov))
+        return new IrMov(*(IrMov*)stmt);
+    else if(istype(stmt, IrArraySet))
+        return new IrArraySet(*(IrArraySet*)stmt);
+    else if(istype(stmt, IrArrayGet))
+        return new IrArrayGet(*(IrArrayGet*)stmt);
+    else if(istype(stmt, IrCondGoto))
+        return new IrCondGoto(*(IrCondGoto*)stmt);
+    else if(istype(stmt, IrGoto))
+        return new IrGoto(*(IrGoto*)stmt);
+    else if(istype(stmt, IrTableGoto))
+        return new IrTableGoto(*(IrTableGoto*)stmt);
+    else if(istype(stmt, IrLabel))
+        return new IrLabel(*(IrLabel*)stmt);
+    else if(istype(stmt, IrParam))
+        return new IrParam(*(IrParam*)stmt);
+    else if(istype(stmt, IrCall))
+        return new IrCall(*(IrCall*)stmt);
+    else if(istype(stmt, IrCallVoid))
+        return new IrCallVoid(*(IrCallVoid*)stmt);
+    else if(istype(stmt, IrReturn))
+        return new IrReturn(*(IrReturn*)stmt);
+    else if(istype(stmt, IrReturnVoid))
+        return new IrReturnVoid(*(IrReturnVoid*)stmt);
+    else if(istype(stmt, IrLocalArrayFillZero))
+        return new IrLocalArrayFillZero(*(IrLocalArrayFillZero*)stmt);
+
+    assert(false); return nullptr;
+}
+
+static IrFuncDef *clone_func(IrFuncDef *func, string name) {
+    // tempvars and labels are numbered program-wide, give the clone its own
+    auto clone = new IrFuncDef(func->root, func->type, name, func->params);
+    clone->substituted_params = func->substituted_params;
+
+    unordered_map<int, int> tempvars, labels;
+    auto remap_tempvar = [&](int tidx) {
+        auto it = tempvars.find(tidx);
+        if(it==tempvars.end())
+            it = tempvars.insert(make_pair(tidx, clone->gen_scalar_tempvar().val.tempvar)).first;
+        return it->second;
+    };
+    auto remap_label = [&](int label) {
+        auto it = labels.find(label);
+        if(it==labels.end())
+            it = labels.insert(make_pair(label, clone->gen_label())).first;
+        return it->second;
+    };
+
+    for(const auto& declpair: func->decls)
+        if(declpair.first->def_or_null)
+            clone->push_decl(new IrDecl(declpair.first->def_or_null), declpair.second);
+        else
+            remap_tempvar(declpair.first->dest.val.tempvar);
+
+    unordered_map<IrParam*, IrParam*> params;
+    for(const auto& stmtpair: func->stmts) {
+        auto stmt = copy_stmt(stmtpair.first);
+        stmt->func = clone;
+        stmt->next.clear();
+        stmt->prev.clear();
+
+        for(auto val: stmt->read_vals())
+            if(val->type==RVal::TempVar)
+                val->val.tempvar = remap_tempvar(val->val.tempvar);
+        for(auto val: stmt->written_vals())
+            if(val->type==LVal::TempVar)
+                val->val.tempvar = remap_tempvar(val->val.tempvar);
+        if(istype(stmt, IrArraySet) && ((IrArraySet*)stmt)->dest.type==LVal::TempVar)
+            ((IrArraySet*)stmt)->dest.val.tempvar = remap_tempvar(((IrArraySet*)stmt)->dest.val.tempvar);
+
+        if(istype(stmt, IrGoto))
+            ((IrGoto*)stmt)->label = remap_label(((IrGoto*)stmt)->label);
+        else if(istype(stmt, IrCondGoto))
+            ((IrCondGoto*)stmt)->label = remap_label(((IrCondGoto*)stmt)->label);
+        else if(istype(stmt, IrTableGoto)) {
+            for(int &label: ((IrTableGoto*)stmt)->labels)
+                label = remap_label(label);
+            ((IrTableGoto*)stmt)->table = remap_label(((IrTableGoto*)stmt)->table);
+        }
+        else if(istype(stmt, IrLabel))
+            ((IrLabel*)stmt)->label = remap_label(((IrLabel*)stmt)->label);
+
+        if(istype(stmt, IrParam))
+            params[(IrParam*)stmtpair.first] = (IrParam*)stmt;
+        if(istype(stmt, IrCallVoid))
+            for(auto &param: ((IrCallVoid*)stmt)->params)
+                param = params[param];
+
+        clone->push_stmt(stmt, stmtpair.second);
+    }
+    return clone;
+}
+
+void IrRoot::specialize_calls() {
+    /*
+     * int f(int x, int m) { ... x % m ... }
+     * f(a, 7); f(b, 7);
+     *
+     * -- m is 7 at every call site, reads of m become 7 --
+     *
+     * int f(int x, int m) { ... x % 7 ... }
+     *
+     * otherwise hot call sites passing constants call a clone of the callee
+     * with those params substituted, within CLONE_BUDGET_STMTS
+     */
+
+    // 1. params every call site agrees on; a recursive call passing the param on unchanged agrees too
+    unordered_map<IrFuncDef*, vector<bool>> substituted;
+    bool changed = true;
+    while(changed) {
+        changed = false;
+
+        unordered_map<IrFuncDef*, vector<pair<IrFuncDef*, IrCallVoid*>>> sites; // callee -> (caller, call)
+        for(const auto& funcpair: funcs)
+            for(const auto& stmtpair: funcpair.first->stmts)
+                if(auto callee = rewritable_callee_or_null(this, stmtpair.first))
+                    sites[callee].push_back(make_pair(funcpair.first, (IrCallVoid*)stmtpair.first));
+
+        for(const auto& sitepair: sites) {
+            auto callee = sitepair.first;
+            auto ok = substitutable_params(callee);
+            auto &done = substituted[callee];
+            done.resize(ok.size(), false);
+
+            for(int i=0; i<(int)ok.size(); i++) {
+                if(!ok[i] || done[i])
+                    continue;
+
+                bool agree = true, found = false;
+                int constval = 0;
+                for(auto site: sitepair.second) {
+                    RVal arg = call_arg(site.second, i);
+                    if(site.first==callee && is_param(arg, callee, i))
+                        continue;
+                    if(arg.type!=RVal::ConstExp || (found && arg.val.constexp!=constval)) {
+                        agree = false;
+                        break;
+                    }
+                    found = true;
+                    constval = arg.val.constexp;
+                }
+
+                if(agree && found && param_is_read_cheaply(callee, i, constval)) {
+                    substitute_param(callee, i, constval);
+                    done[i] = true;
+                    changed = true;
+                }
+            }
+            fold_consts(callee);
+        }
+    }
+
+    // 2. clones for hot call sites, passes repeat since clones may pass constants on
+    map<pair<string, vector<pair<int, int>>>, IrFuncDef*> clones; // (callee, [(pidx, const)]) -> clone
+    int budget = CLONE_BUDGET_STMTS;
+    changed = true;
+    while(changed) {
+        changed = false;
+
+        vector<IrFuncDef*> callers;
+        for(const auto& funcpair: funcs)
+            if(!istype(funcpair.first, IrFuncDefBuiltin))
+                callers.push_back(funcpair.first);
+
+        for(auto caller: callers) {
+            auto depths = caller->loop_depths();
+            for(const auto& stmtpair: caller->stmts) {
+                auto callee = rewritable_callee_or_null(this, stmtpair.first);
+                if(!callee || callee==caller || (int)callee->stmts.size()>CLONE_MAX_STMTS)
+                    continue;
+                auto call = (IrCallVoid*)stmtpair.first;
+
+                bool recursive = false;
+                for(const auto& calleestmt: callee->stmts)
+                    if(rewritable_callee_or_null(this, calleestmt.first)==callee)
+                        recursive = true;
+                if(depths[call]==0 && !recursive)
+                    continue;
+
+                auto ok = substitutable_params(callee);
+                vector<pair<int, int>> spec;
+                for(int i=0; i<(int)ok.size(); i++) {
+                    RVal arg = call_arg(call, i);
+                    if(ok[i] && arg.type==RVal::ConstExp && param_is_read_cheaply(callee, i, arg.val.constexp))
+                        spec.push_back(make_pair(i, arg.val.constexp));
+                }
+                if(spec.empty())
+                    continue;
+
+                auto key = make_pair(callee->name, spec);
+                auto it = clones.find(key);
+                if(it!=clones.end() && func_index(this, it->second)>func_index(this, caller))
+                    continue; // calling it would form a cycle, see below
+                if(it==clones.end()) {
+                    if(budget<(int)callee->stmts.size())
+                        continue;
+                    budget -= callee->stmts.size();
+
+                    string name;
+                    for(int n=(int)clones.size(); name.empty() || find_func_or_null(this, name); n++)
+                        name = callee->name + "_spec" + to_string(n);
+                    auto clone = clone_func(callee, name);
+
+                    // recursive calls passing the same constants stay in the clone
+                    for(const auto& clonestmt: clone->stmts) {
+                        if(rewritable_callee_or_null(this, clonestmt.first)!=callee)
+                            continue;
+                        auto selfcall = (IrCallVoid*)clonestmt.first;
+                        bool same = true;
+                        for(auto specpair: spec) {
+                            RVal arg = call_arg(selfcall, specpair.first);
+                            if(!is_param(arg, clone, specpair.first) && !(arg.type==RVal::ConstExp && arg.val.constexp==specpair.second))
+                                same = false;
+                        }
+                        if(same)
+                            selfcall->name = name;
+                    }
+
+                    for(auto specpair: spec)
+                        substitute_param(clone, specpair.first, specpair.second);
+                    fold_consts(clone);
+
+                    /*
+                     * destroy sets are calculated in list order, so every func must come after
+                     * its callees (except itself); the callee comes before all its callers, so
+                     * right after it the clone does too
+                     */
+                    for(auto fit=funcs.begin(); fit!=funcs.end(); fit++)
+                        if(fit->first==callee) {
+                            funcs.insert(++fit, make_pair(clone, "specialized " + callee->name));
+                            break;
+                        }
+                    it = clones.insert(make_pair(key, clone)).first;
+                    changed = true;
+                }
+                call->name = it->second->name;
+            }
+        }
+    }
+}
@@ -180,17 +180,24 @@ struct IrFuncDef: IrDeclContainer {
     string name;
     AstFuncDefParams *params;
     list<Commented(IrStmt*)> stmts;
+    unordered_set<int> substituted_params; // pidx replaced by constants in `specialize_calls`, so may be unused
 
     /* // flag:return-label
     int return_label;
     LVal _eeyore_retval_var; // used in gen_eeyore, this tempvar is not in cfg because tigger doesn't need it
     */
 
+    /* stack frame, in words:
+     * [0, spillsize)                               spill slots, shared by non-interfering vars
+     * [spillsize, +callersavesize)                 caller save slots not covered by dead spill slots
+     * [spillsize+callersavesize, +arraysize)       local arrays
+     */
     int spillsize; // in words
     int callersavesize; // in words, initialized in `report_destroyed_set`
+    int arraysize; // in words
 
     IrFuncDef(IrRoot *root, FuncType type, string name, AstFuncDefParams *params): IrDeclContainer(),
-       root(root), type(type), name(name), params(params), stmts({}), spillsize(0), callersavesize(0)
+       root(root), type(type), name(name), params(params), stmts({}), spillsize(0), callersavesize(0), arraysize(0)
        /* // flag:return-label
        , return_label(gen_label()), _eeyore_retval_var(gen_scalar_tempvar())
        */ {}
@@ -202,6 +209,11 @@ struct IrFuncDef: IrDeclContainer {
     virtual void output_eeyore(list<string> &buf);
     virtual void gen_inst(InstRoot *root);
     virtual bool peekhole_optimize();
+    virtual void split_local_arrays();
+    virtual void combine_insts();
+    virtual void promote_globals();
+    virtual void hoist_loop_consts();
+    virtual void eliminate_dead_code();
 
     // cfg
 
@@ -222,9 +234,15 @@ struct IrFuncDef: IrDeclContainer {
         return get_vreg(val.reguid());
     }
 
+    unordered_map<IrStmt*, int> loop_depths();
+    unordered_set<AstDef*> referenced_defs();
+
     virtual void connect_all_cfg();
     virtual void regalloc();
     virtual void report_destroyed_set();
+
+    vector<int> free_spill_slots(IrStmt *call);
+    int callersave_slot(IrStmt *call, int i);
 };
 
 struct IrFuncDefBuiltin: IrFuncDef {
@@ -234,6 +252,11 @@ struct IrFuncDefBuiltin: IrFuncDef {
     void output_eeyore(list<string> &buf) override {assert(false);};
     void gen_inst(InstRoot *root) override = 0;
     bool peekhole_optimize() override {return false;}
+    void split_local_arrays() override {}
+    void combine_insts() override {}
+    void promote_globals() override {}
+    void hoist_loop_consts() override {}
+    void eliminate_dead_code() override {}
 
     void connect_all_cfg() override {}
     void regalloc() override {}
@@ -248,6 +271,10 @@ struct IrRoot: IrDeclContainer {
 
     unordered_map<string, unordered_set<Preg, Preg::Hash>> destroy_sets;
 
+    // global scalars each function may write / read, including through its callees
+    unordered_map<string, unordered_set<AstDef*>> mod_sets, ref_sets;
+    unordered_set<string> called_funcs;
+
     IrRoot():
         IrDeclContainer(), inits({}), funcs({}), tempvar_top(0), label_top(0) {}
 
@@ -276,6 +303,11 @@ struct IrRoot: IrDeclContainer {
     void gen_inst(InstRoot *root);
 
     void install_builtin_destroy_sets();
+    void specialize_calls();
+    void inline_builtin_calls();
+    void memoize_pure_funcs();
+    void calc_modref_sets();
+    void drop_unused_globals();
 };
 
 ///// STATEMENT
@@ -294,6 +326,10 @@ struct IrStmt: Ir {
     virtual vector<int> defs() { return vector<int>(); }
     virtual vector<int> uses() { return vector<int>(); }
 
+    // operands, for rewriting passes: scalar vals read and written by the stmt
+    virtual vector<RVal*> read_vals() { return vector<RVal*>(); }
+    virtual vector<LVal*> written_vals() { return vector<LVal*>(); }
+
     // regalloc
     bool _regalloc_inqueue = false;
     unordered_set<int> alive_pooled_vars;
@@ -329,6 +365,10 @@ struct IrOpBinary: IrStmt {
         push_if_pooled(operand2);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&operand1, &operand2}; }
+    vector<LVal*> written_vals() override { return {&dest}; }
 };
 
 struct IrOpUnary: IrStmt {
@@ -353,6 +393,10 @@ struct IrOpUnary: IrStmt {
         push_if_pooled(operand);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&operand}; }
+    vector<LVal*> written_vals() override { return {&dest}; }
 };
 
 struct IrMov: IrStmt {
@@ -376,6 +420,10 @@ struct IrMov: IrStmt {
         push_if_pooled(src);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&src}; }
+    vector<LVal*> written_vals() override { return {&dest}; }
 };
 
 struct IrArraySet: IrStmt {
@@ -399,6 +447,9 @@ struct IrArraySet: IrStmt {
         push_if_pooled(src);
         return v;
     }
+
+    // operands, the array base is not a scalar val
+    vector<RVal*> read_vals() override { return {&src}; }
 };
 
 struct IrArrayGet: IrStmt {
@@ -426,6 +477,10 @@ struct IrArrayGet: IrStmt {
         push_if_pooled(src);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&src}; }
+    vector<LVal*> written_vals() override { return {&dest}; }
 };
 
 
@@ -453,6 +508,9 @@ struct IrCondGoto: IrStmt {
         push_if_pooled(operand2);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&operand1, &operand2}; }
 };
 
 struct IrGoto: IrStmt {
@@ -471,6 +529,36 @@ struct IrGoto: IrStmt {
     }
 };
 
+struct IrTableGoto: IrStmt { // goto labels[operand], operand is known to be in range
+    RVal operand;
+    vector<int> labels;
+    int table; // label of the table itself, placed in .rodata
+
+    IrTableGoto(IrFuncDef *func, RVal operand, vector<int> labels, int table): IrStmt(func),
+        operand(operand), labels(labels), table(table) {}
+
+    void output_eeyore(list<string> &buf) override;
+    void gen_inst(InstFuncDef *func) override;
+
+    // cfg
+    void cfg_calc_next(IrStmt *_nextline) override {
+        unordered_set<int> seen;
+        for(int label: labels)
+            if(seen.insert(label).second) {
+                auto label_stmt = func->labels.find(label)->second;
+                next.push_back((IrStmt*)label_stmt);
+            }
+    }
+    vector<int> uses() override {
+        auto v = vector<int>();
+        push_if_pooled(operand);
+        return v;
+    }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&operand}; }
+};
+
 struct IrLabel: IrStmt {
     int label;
 
@@ -499,6 +587,9 @@ struct IrParam: IrStmt {
         push_if_pooled(param);
         return v;
     }
+
+    // operands, reported here rather than by the call
+    vector<RVal*> read_vals() override { return {&param}; }
 };
 
 struct IrCallVoid: IrStmt {
@@ -539,6 +630,9 @@ struct IrCall: IrCallVoid {
         push_if_pooled(ret);
         return v;
     }
+
+    // operands
+    vector<LVal*> written_vals() override { return {&ret}; }
 };
 
 struct IrReturnVoid: IrStmt {
@@ -576,6 +670,9 @@ struct IrReturn: IrStmt {
         push_if_pooled(retval);
         return v;
     }
+
+    // operands
+    vector<RVal*> read_vals() override { return {&retval}; }
 };
 /* // flag:return-label
 struct IrLabelReturn: IrLabel {
@@ -592,10 +689,12 @@ struct IrLabelReturn: IrLabel {
 
 struct IrLocalArrayFillZero: IrStmt {
     LVal dest;
+    int begin, count; // elements [begin, begin+count)
 
-    IrLocalArrayFillZero(IrFuncDef *func, LVal dest): IrStmt(func),
-        dest(dest) {
+    IrLocalArrayFillZero(IrFuncDef *func, LVal dest, int begin, int count): IrStmt(func),
+        dest(dest), begin(begin), count(count) {
         assert(dest.type==LVal::Reference);
+        assert(begin>=0 && count>0);
     }
 
     void output_eeyore(list<string> &buf) override;
@@ -89,6 +89,12 @@ void IrFuncDef::push_stmt(IrStmt *stmt, string comment) {
 }
 
 void IrFuncDef::connect_all_cfg() {
+    // may be called again after stmts changed
+    for(const auto& stmtpair: stmts) {
+        stmtpair.first->next.clear();
+        stmtpair.first->prev.clear();
+    }
+
     for(auto it = stmts.cbegin(); it!=stmts.cend();) {
         auto stmt = it->first;
         it++;
@@ -105,6 +111,65 @@ void IrFuncDef::connect_all_cfg() {
     }
 }
 
+unordered_map<IrStmt*, int> IrFuncDef::loop_depths() {
+    // every backward jump closes a loop: stmts from its label to itself are one level deeper
+    unordered_map<IrStmt*, int> index;
+    vector<IrStmt*> order;
+    for(const auto& stmtpair: stmts) {
+        index.insert(make_pair(stmtpair.first, (int)order.size()));
+        order.push_back(stmtpair.first);
+    }
+
+    vector<int> delta(order.size()+1, 0);
+    for(int i=0; i<(int)order.size(); i++) {
+        int label = -1;
+        if(istype(order[i], IrGoto))
+            label = ((IrGoto*)order[i])->label;
+        else if(istype(order[i], IrCondGoto))
+            label = ((IrCondGoto*)order[i])->label;
+
+        auto lit = labels.find(label);
+        if(lit==labels.end())
+            continue;
+        auto iit = index.find(lit->second);
+        if(iit!=index.end() && iit->second<=i) {
+            delta[iit->second]++;
+            delta[i+1]--;
+        }
+    }
+
+    unordered_map<IrStmt*, int> depths;
+    int depth = 0;
+    for(int i=0; i<(int)order.size(); i++) {
+        depth += delta[i];
+        depths.insert(make_pair(order[i], depth));
+    }
+    return depths;
+}
+
+unordered_set<AstDef*> IrFuncDef::referenced_defs() {
+    unordered_set<AstDef*> defs;
+    auto add_if_reference = [&](RVal v) {
+        if(v.type==RVal::Reference)
+            defs.insert(v.val.reference);
+    };
+
+    for(const auto& stmtpair: stmts) {
+        auto stmt = stmtpair.first;
+        for(auto val: stmt->read_vals())
+            add_if_reference(*val);
+        for(auto val: stmt->written_vals())
+            add_if_reference(*val);
+
+        // array bases are not among the written vals
+        if(istype(stmt, IrArraySet))
+            add_if_reference(((IrArraySet*)stmt)->dest);
+        else if(istype(stmt, IrLocalArrayFillZero))
+            add_if_reference(((IrLocalArrayFillZero*)stmt)->dest);
+    }
+    return defs;
+}
+
 void IrFuncDef::report_destroyed_set() {
     unordered_set<Preg, Preg::Hash> destory_set;
 
@@ -139,8 +204,8 @@ void IrFuncDef::report_destroyed_set() {
             for(auto var: subfn_destroyset)
                 destory_set.insert(var);
 
-            // update caller save size
-            int workingset = 0;
+            // update caller save size, slots of spilled vars which are dead here can be reused
+            int workingset = -(int)free_spill_slots(stmtpair.first).size();
             for(auto uid: stmtpair.first->alive_pooled_vars) {
                 auto vit = vreg_map.find(uid);
                 if(vit!=vreg_map.end() && vit->second.pos==Vreg::VregInReg) { // for current working set
@@ -155,6 +220,47 @@ void IrFuncDef::report_destroyed_set() {
 
     // update destory sets
     root->destroy_sets[name] = destory_set;
+
+    // now the frame layout is known: place local arrays above spill and caller save slots
+    for(auto declpair: decl_map)
+        if(declpair.second->idxinfo->dims()>0)
+            vreg_map.find(declpair.first)->second.spilloffset += spillsize + callersavesize;
+    for(auto &vregpair: vreg_map)
+        if(vregpair.second.pos==Vreg::VregRemat && vregpair.second.remat==Vreg::RematAddrStack)
+            vregpair.second.spilloffset += spillsize + callersavesize;
+}
+
+vector<int> IrFuncDef::free_spill_slots(IrStmt *call) {
+    unordered_set<int> occupied;
+
+    // vars passed to, alive across or returned from the call
+    auto mark_occupied = [&](const unordered_set<int> &uids) {
+        for(auto uid: uids) {
+            auto vit = vreg_map.find(uid);
+            if(vit!=vreg_map.end() && vit->second.pos==Vreg::VregInStack)
+                occupied.insert(vit->second.spilloffset);
+        }
+    };
+    mark_occupied(call->alive_pooled_vars);
+    mark_occupied(call->meet_pooled_vars);
+    auto defs = call->defs();
+    mark_occupied(unordered_set<int>(defs.begin(), defs.end()));
+
+    vector<int> slots;
+    for(int slot=0; slot<spillsize; slot++)
+        if(occupied.find(slot)==occupied.end())
+            slots.push_back(slot);
+    return slots;
+}
+
+int IrFuncDef::callersave_slot(IrStmt *call, int i) {
+    auto slots = free_spill_slots(call);
+    if(i<(int)slots.size())
+        return slots[i];
+
+    i -= slots.size();
+    assert(i<callersavesize);
+    return spillsize + i;
 }
 
 void IrRoot::install_builtin_destroy_sets() {
@@ -0,0 +1,180 @@
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+const int MEMO_MAX_PARAMS = 6;
+const int MEMO_TABLE_ENTRIES = 4096; // power of 2
+const int MEMO_HASH_MUL = 127;
+
+static IrFuncDef *user_func_or_null(IrRoot *root, string name) {
+    for(const auto& funcpair: root->funcs)
+        if(funcpair.first->name==name && !istype(funcpair.first, IrFuncDefBuiltin))
+            return funcpair.first;
+    return nullptr;
+}
+
+static unordered_set<IrFuncDef*> pure_funcs(IrRoot *root) {
+    /*
+     * a pure func only reads its scalar params and local arrays, and only calls pure funcs,
+     * so its result depends on its args alone; library funcs do I/O, builtins write arrays
+     */
+    unordered_set<IrFuncDef*> pure;
+    for(const auto& funcpair: root->funcs) {
+        auto func = funcpair.first;
+        if(istype(func, IrFuncDefBuiltin))
+            continue;
+
+        bool ok = true;
+        for(auto def: func->params->val)
+            if(def->idxinfo->dims()>0)
+                ok = false;
+        for(auto def: func->referenced_defs())
+            if(def->pos==DefGlobal)
+                ok = false;
+        if(ok)
+            pure.insert(func);
+    }
+
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(const auto& funcpair: root->funcs) {
+            auto func = funcpair.first;
+            if(pure.find(func)==pure.end())
+                continue;
+
+            for(const auto& stmtpair: func->stmts) {
+                if(!istype(stmtpair.first, IrCallVoid)) // also IrCall
+                    continue;
+                auto callee = user_func_or_null(root, ((IrCallVoid*)stmtpair.first)->name);
+                if(!callee || pure.find(callee)==pure.end()) {
+                    pure.erase(func);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    return pure;
+}
+
+static AstDef *new_memo_table(IrRoot *root, IrFuncDef *func, int words) {
+    auto idxinfo = new AstMaybeIdx();
+    idxinfo->push_val(new AstExpLiteral(words));
+
+    auto def = new AstDef(func->name + "_memo", idxinfo, nullptr);
+    def->type = VarInt;
+    def->ast_is_const = false;
+    def->effectively_const = false;
+    def->pos = DefGlobal;
+    def->index = AstDef::gen_index();
+    def->calc_initval();
+
+    root->push_decl(new IrDecl(def), def->name);
+    return def;
+}
+
+static void memoize(IrFuncDef *func) {
+    /*
+     * h = (p0 * MUL + p1) * MUL + ...  % ENTRIES, made non-negative
+     * ptr = table + h * stride         <- entry: valid, p0, p1, ..., result
+     * if ptr [0] == 0 goto miss
+     * if ptr [4] != p0 goto miss
+     * ...
+     * return ptr [4*(n+1)]
+     * miss:
+     * ...                              <- original body, params may be assigned
+     * ptr [4*(n+1)] = result           <- before each return
+     * ptr [4] = p0 as passed in
+     * ...
+     * ptr [0] = 1
+     * return result
+     */
+    int nparams = func->params->val.size();
+    int stride = 4;
+    while(stride<nparams+2)
+        stride *= 2;
+    int resoffset = (nparams+1)*4;
+
+    auto table = new_memo_table(func->root, func, MEMO_TABLE_ENTRIES*stride);
+
+    auto old_stmts = func->stmts;
+    func->stmts.clear();
+
+    // params as passed in, copied if the body assigns them
+    unordered_set<AstDef*> assigned;
+    for(const auto& stmtpair: old_stmts)
+        for(auto val: stmtpair.first->written_vals())
+            if(val->type==LVal::Reference)
+                assigned.insert(val->val.reference);
+
+    vector<RVal> args;
+    for(auto def: func->params->val) {
+        if(assigned.find(def)==assigned.end()) {
+            args.push_back(def);
+            continue;
+        }
+        LVal arg = func->gen_scalar_tempvar();
+        func->push_stmt(new IrMov(func, arg, def), "memo - arg");
+        args.push_back(arg);
+    }
+
+    LVal h = func->gen_scalar_tempvar();
+    func->push_stmt(new IrMov(func, h, args[0]), "memo - hash");
+    for(int i=1; i<nparams; i++) {
+        func->push_stmt(new IrOpBinary(func, h, h, OpMul, RVal::asConstExp(MEMO_HASH_MUL)));
+        func->push_stmt(new IrOpBinary(func, h, h, OpPlus, args[i]));
+    }
+    int lnonneg = func->gen_label();
+    func->push_stmt(new IrOpBinary(func, h, h, OpMod, RVal::asConstExp(MEMO_TABLE_ENTRIES)));
+    func->push_stmt(new IrCondGoto(func, h, RelGeq, RVal::asConstExp(0), lnonneg));
+    func->push_stmt(new IrOpBinary(func, h, h, OpPlus, RVal::asConstExp(MEMO_TABLE_ENTRIES)));
+    func->push_stmt(new IrLabel(func, lnonneg));
+
+    LVal ptr = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpBinary(func, h, h, OpMul, RVal::asConstExp(stride*4)));
+    func->push_stmt(new IrOpBinary(func, ptr, table, OpPlus, h), "memo - entry");
+
+    int lmiss = func->gen_label();
+    LVal x = func->gen_scalar_tempvar();
+    func->push_stmt(new IrArrayGet(func, x, ptr, 0));
+    func->push_stmt(new IrCondGoto(func, x, RelEq, RVal::asConstExp(0), lmiss), "memo - valid");
+    for(int i=0; i<nparams; i++) {
+        LVal y = func->gen_scalar_tempvar();
+        func->push_stmt(new IrArrayGet(func, y, ptr, (i+1)*4));
+        func->push_stmt(new IrCondGoto(func, y, RelNeq, args[i], lmiss), "memo - compare arg");
+    }
+    LVal res = func->gen_scalar_tempvar();
+    func->push_stmt(new IrArrayGet(func, res, ptr, resoffset));
+    func->push_stmt(new IrReturn(func, res), "memo - hit");
+    func->push_stmt(new IrLabel(func, lmiss));
+
+    for(const auto& stmtpair: old_stmts) {
+        if(istype(stmtpair.first, IrReturn)) {
+            auto retstmt = (IrReturn*)stmtpair.first;
+            func->push_stmt(new IrArraySet(func, ptr, resoffset, retstmt->retval), "memo - store");
+            for(int i=0; i<nparams; i++)
+                func->push_stmt(new IrArraySet(func, ptr, (i+1)*4, args[i]));
+            func->push_stmt(new IrArraySet(func, ptr, 0, RVal::asConstExp(1)));
+        }
+        func->push_stmt(stmtpair.first, stmtpair.second);
+    }
+}
+
+void IrRoot::memoize_pure_funcs() {
+    // pure int funcs recursing more than once per call would recompute the same args over and over
+    auto pure = pure_funcs(this);
+    for(const auto& funcpair: funcs) {
+        auto func = funcpair.first;
+        int nparams = func->params->val.size();
+        if(pure.find(func)==pure.end() || func->type!=FuncInt || nparams==0 || nparams>MEMO_MAX_PARAMS)
+            continue;
+
+        int selfcalls = 0;
+        for(const auto& stmtpair: func->stmts)
+            if(istype(stmtpair.first, IrCallVoid) && ((IrCallVoid*)stmtpair.first)->name==func->name)
+                selfcalls++;
+        if(selfcalls>1)
+            memoize(func);
+    }
+}
@@ -5,10 +5,20 @@ bool IrFuncDef::peekhole_optimize() {
     bool changed = false;
     auto lastit = stmts.end();
 
+    // tempvars from expressions are read once, but promoted or split vars are read many times
+    unordered_map<int, int> tempvar_reads;
+    for(auto &stmt: stmts) {
+        for(auto val: stmt.first->read_vals())
+            if(val->type==RVal::TempVar)
+                tempvar_reads[val->val.tempvar]++;
+        if(istype(stmt.first, IrArraySet) && ((IrArraySet*)stmt.first)->dest.type==LVal::TempVar)
+            tempvar_reads[((IrArraySet*)stmt.first)->dest.val.tempvar]++;
+    }
+
     for(auto it=stmts.begin(); it!=stmts.end();) {
         if(istype(it->first, IrMov)) {
             auto *movstmt = (IrMov*)it->first;
-            if(movstmt->src.type==RVal::TempVar && lastit!=stmts.end()) {
+            if(movstmt->src.type==RVal::TempVar && tempvar_reads[movstmt->src.val.tempvar]==1 && lastit!=stmts.end()) {
                 /*
                  * tempvar = op1 op op2   <- last
                  * T... = tempvar         <- movstmt
@@ -19,8 +29,11 @@ bool IrFuncDef::peekhole_optimize() {
                  */
 
                 auto last = lastit->first;
+                auto lastdefs = last->written_vals();
 
-                if(istype(last, IrOpBinary)) {
+                if(lastdefs.size()!=1 || *lastdefs[0]!=movstmt->src) {
+                    // last stmt does not produce the moved tempvar
+                } else if(istype(last, IrOpBinary)) {
                     ((IrOpBinary*)last)->dest = movstmt->dest;
                     it = stmts.erase(it);
                     changed = true; continue;
@@ -42,7 +55,7 @@ bool IrFuncDef::peekhole_optimize() {
             auto *gotostmt = (IrCondGoto*)it->first;
             if(
                 gotostmt->operand1.type==RVal::TempVar && gotostmt->operand2.type==RVal::ConstExp
-                && gotostmt->operand2.val.constexp==0
+                && gotostmt->operand2.val.constexp==0 && tempvar_reads[gotostmt->operand1.val.tempvar]==1
             ) {
                 if(lastit!=stmts.end() && istype(lastit->first, IrOpBinary)) {
                     /*
@@ -0,0 +1,273 @@
+#include <map>
+using std::map;
+
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+static AstDef *global_scalar_or_null(RVal v) {
+    if(v.type==RVal::Reference && v.val.reference->pos==DefGlobal && v.val.reference->idxinfo->dims()==0)
+        return v.val.reference;
+    return nullptr;
+}
+
+static string called_name_or_empty(IrStmt *stmt) {
+    if(istype(stmt, IrCallVoid)) // also IrCall
+        return ((IrCallVoid*)stmt)->name;
+    return "";
+}
+
+void IrRoot::calc_modref_sets() {
+    mod_sets.clear();
+    ref_sets.clear();
+    called_funcs.clear();
+
+    // direct accesses
+    unordered_map<string, unordered_set<string>> callees;
+    for(const auto& funcpair: funcs) {
+        auto func = funcpair.first;
+        auto &mod = mod_sets[func->name];
+        auto &ref = ref_sets[func->name];
+
+        for(const auto& stmtpair: func->stmts) {
+            for(auto val: stmtpair.first->read_vals())
+                if(auto def = global_scalar_or_null(*val))
+                    ref.insert(def);
+            for(auto val: stmtpair.first->written_vals())
+                if(auto def = global_scalar_or_null(*val))
+                    mod.insert(def);
+
+            string callee = called_name_or_empty(stmtpair.first);
+            if(!callee.empty()) {
+                callees[func->name].insert(callee);
+                called_funcs.insert(callee);
+            }
+        }
+    }
+
+    // propagate along the call graph until stable, library funcs touch no globals
+    bool changed = true;
+    while(changed) {
+        changed = false;
+        for(const auto& callerpair: callees) {
+            for(const auto& callee: callerpair.second) {
+                if(mod_sets.find(callee)==mod_sets.end())
+                    continue;
+
+                for(auto def: mod_sets[callee])
+                    if(mod_sets[callerpair.first].insert(def).second)
+                        changed = true;
+                for(auto def: ref_sets[callee])
+                    if(ref_sets[callerpair.first].insert(def).second)
+                        changed = true;
+            }
+        }
+    }
+}
+
+void IrRoot::drop_unused_globals() {
+    // e.g. const arrays whose reads were all folded to constants
+    unordered_set<AstDef*> used;
+    for(const auto& funcpair: funcs)
+        for(auto def: funcpair.first->referenced_defs())
+            used.insert(def);
+
+    for(auto it=decls.begin(); it!=decls.end();) {
+        if(used.find(it->first->def_or_null)==used.end())
+            it = decls.erase(it);
+        else
+            it++;
+    }
+    for(auto it=inits.begin(); it!=inits.end();) {
+        if(used.find(it->first->def)==used.end())
+            it = inits.erase(it);
+        else
+            it++;
+    }
+}
+
+void IrFuncDef::promote_globals() {
+    /*
+     * every access to a promoted global goes to a tempvar instead:
+     *
+     * tg = g                       <- func entry
+     * ...
+     * g = tg                       <- before calls that may read or write g, if g is written here
+     * call f
+     * tg = g                       <- after calls that may write g
+     * ...
+     * g = tg                       <- before returns, if g is written here
+     * return
+     */
+
+    const int LOAD_COST = 2; // lui + lw
+    const int STORE_COST = 3; // lui + addi + sw
+
+    auto depths = loop_depths();
+    auto weight_of = [&](IrStmt *stmt) {
+        int weight = 1;
+        for(int d=0; d<depths[stmt] && d<6; d++)
+            weight *= 8;
+        return weight;
+    };
+
+    // insts saved by turning accesses into reg ops
+    unordered_map<AstDef*, int> savings;
+    unordered_set<AstDef*> dirty;
+    for(const auto& stmtpair: stmts) {
+        int weight = weight_of(stmtpair.first);
+        for(auto val: stmtpair.first->read_vals())
+            if(auto def = global_scalar_or_null(*val))
+                savings[def] += weight * LOAD_COST;
+        for(auto val: stmtpair.first->written_vals())
+            if(auto def = global_scalar_or_null(*val)) {
+                savings[def] += weight * STORE_COST;
+                dirty.insert(def);
+            }
+    }
+
+    // nothing observes globals after main returns, unless main is called recursively
+    bool store_at_return = name!="main" || root->called_funcs.find(name)!=root->called_funcs.end();
+
+    for(auto savingpair: savings) {
+        auto def = savingpair.first;
+        bool isdirty = dirty.find(def)!=dirty.end();
+
+        // insts paid at entry, calls and returns
+        int cost = LOAD_COST;
+        for(const auto& stmtpair: stmts) {
+            auto stmt = stmtpair.first;
+            string callee = called_name_or_empty(stmt);
+            if(!callee.empty() && root->mod_sets.find(callee)!=root->mod_sets.end()) {
+                bool mod = root->mod_sets[callee].find(def)!=root->mod_sets[callee].end();
+                bool ref = root->ref_sets[callee].find(def)!=root->ref_sets[callee].end();
+                if(isdirty && (mod || ref))
+                    cost += weight_of(stmt) * STORE_COST;
+                if(mod)
+                    cost += weight_of(stmt) * LOAD_COST;
+            }
+            if(isdirty && store_at_return && (istype(stmt, IrReturn) || istype(stmt, IrReturnVoid)))
+                cost += weight_of(stmt) * STORE_COST;
+        }
+        if(savingpair.second<=cost)
+            continue;
+
+        // rewrite
+        LVal tg = gen_scalar_tempvar();
+        for(auto it=stmts.begin(); it!=stmts.end(); it++) {
+            auto stmt = it->first;
+            for(auto val: stmt->read_vals())
+                if(global_scalar_or_null(*val)==def)
+                    *val = tg;
+            for(auto val: stmt->written_vals())
+                if(global_scalar_or_null(*val)==def)
+                    *val = tg;
+
+            string callee = called_name_or_empty(stmt);
+            if(!callee.empty() && root->mod_sets.find(callee)!=root->mod_sets.end()) {
+                bool mod = root->mod_sets[callee].find(def)!=root->mod_sets[callee].end();
+                bool ref = root->ref_sets[callee].find(def)!=root->ref_sets[callee].end();
+                if(isdirty && (mod || ref))
+                    stmts.insert(it, make_pair(new IrMov(this, def, tg), "promoted global - store for call"));
+
+                // `g = f()` stores the return value after f writes g
+                if(mod && !(istype(stmt, IrCall) && ((IrCall*)stmt)->ret==tg)) {
+                    auto nextit = it;
+                    nextit++;
+                    it = stmts.insert(nextit, make_pair(new IrMov(this, tg, def), "promoted global - reload after call"));
+                }
+            }
+            if(isdirty && store_at_return && (istype(stmt, IrReturn) || istype(stmt, IrReturnVoid)))
+                stmts.insert(it, make_pair(new IrMov(this, def, tg), "promoted global - store for return"));
+        }
+        stmts.push_front(make_pair(new IrMov(this, tg, def), "promoted global - load"));
+    }
+}
+
+void IrFuncDef::hoist_loop_consts() {
+    /*
+     * branches have no immediate form, so a loop test against a constant bound
+     * costs a li every iteration; keep such constants in tempvars set right before
+     * the outermost loop instead, regalloc rematerializes them if they get spilled
+     *
+     * 0 and ±1 are left alone, they compare with x0 after normalization; loops with
+     * calls are left alone too, the tempvar would be saved and restored around each call
+     */
+    vector<IrStmt*> order;
+    unordered_map<IrStmt*, int> index;
+    for(const auto& stmtpair: stmts) {
+        index.insert(make_pair(stmtpair.first, (int)order.size()));
+        order.push_back(stmtpair.first);
+    }
+
+    auto jump_label = [](IrStmt *stmt) {
+        if(istype(stmt, IrGoto))
+            return ((IrGoto*)stmt)->label;
+        else if(istype(stmt, IrCondGoto))
+            return ((IrCondGoto*)stmt)->label;
+        return -1;
+    };
+
+    // loops as [label, backward jump] ranges, same as `loop_depths`
+    vector<pair<int, int>> loops;
+    for(int i=0; i<(int)order.size(); i++) {
+        auto lit = labels.find(jump_label(order[i]));
+        if(lit!=labels.end() && index[lit->second]<=i)
+            loops.push_back(make_pair(index[lit->second], i));
+    }
+
+    vector<int> calls_before(order.size()+1, 0); // prefix count of calls
+    for(int i=0; i<(int)order.size(); i++)
+        calls_before[i+1] = calls_before[i] + (istype(order[i], IrCallVoid) ? 1 : 0);
+
+    // the loop label must only be entered by falling through, or from inside the loop
+    auto entered_from_outside = [&](pair<int, int> loop) {
+        int label = ((IrLabel*)order[loop.first])->label;
+        for(int i=0; i<(int)order.size(); i++)
+            if((i<loop.first || i>loop.second) && jump_label(order[i])==label)
+                return true;
+        return false;
+    };
+
+    map<pair<int, int>, LVal> hoisted; // (loop start, const) -> tempvar
+
+    for(int i=0; i<(int)order.size(); i++) {
+        if(!istype(order[i], IrCondGoto))
+            continue;
+
+        auto gotostmt = (IrCondGoto*)order[i];
+        if(gotostmt->operand1.type==RVal::ConstExp && gotostmt->operand2.type==RVal::ConstExp)
+            continue;
+
+        // outermost enclosing loop, every enclosing loop must be free of calls
+        int outer = -1;
+        bool hascall = false;
+        for(int l=0; l<(int)loops.size(); l++)
+            if(loops[l].first<=i && i<=loops[l].second) {
+                if(calls_before[loops[l].second+1]!=calls_before[loops[l].first])
+                    hascall = true;
+                if(outer==-1 || loops[l].first<loops[outer].first || loops[l].second>loops[outer].second)
+                    outer = l;
+            }
+        if(outer==-1 || hascall || entered_from_outside(loops[outer]))
+            continue;
+
+        for(auto val: gotostmt->read_vals()) {
+            if(val->type!=RVal::ConstExp || (val->val.constexp>=-1 && val->val.constexp<=1))
+                continue;
+
+            auto key = make_pair(loops[outer].first, val->val.constexp);
+            auto it = hoisted.find(key);
+            if(it==hoisted.end())
+                it = hoisted.insert(make_pair(key, gen_scalar_tempvar())).first;
+            *val = it->second;
+        }
+    }
+
+    for(auto hoistpair: hoisted) {
+        auto it = stmts.begin();
+        while(it->first!=order[hoistpair.first.first])
+            it++;
+        stmts.insert(it, make_pair(new IrMov(this, hoistpair.second, RVal::asConstExp(hoistpair.first.second)), "hoisted loop const"));
+    }
+}
@@ -5,7 +5,42 @@ Preg Vreg::load_into_preg(InstFuncDef *func, int tempregidx) {
     assert(tempregidx == 0 || tempregidx == 1);
     if(pos==VregInStack) {
         Preg tmpreg = Preg('t', tempregidx);
-        func->push_stmt(new InstLoadStack(tmpreg, spilloffset));
+        Preg othertmp = Preg('t', 1-tempregidx);
+
+        // reuse the value if still cached in some reg of this block
+        auto cached = func->find_cached_slot(spilloffset);
+        for(Preg reg: cached)
+            if(reg==tmpreg)
+                return tmpreg;
+        for(Preg reg: cached)
+            if(reg!=othertmp) { // spare or allocated reg, or x0
+                func->spare_taken.push_back(reg);
+                return reg;
+            }
+        if(!cached.empty()) { // in the other temp reg, which may be overwritten soon
+            func->push_stmt(new InstMov(tmpreg, othertmp));
+            return tmpreg;
+        }
+
+        // load into a spare reg if any, so that it survives later uses of temp regs
+        Preg dest = func->take_spare_reg(tmpreg);
+        func->push_stmt(new InstLoadStack(dest, spilloffset));
+        return dest;
+    } else if(pos==VregRemat) { // recompute instead of reloading
+        Preg tmpreg = Preg('t', tempregidx);
+        switch(remat) {
+            case RematImm:
+                if(rematval==0)
+                    return Preg('x', 0);
+                func->push_stmt(new InstLoadImm(tmpreg, rematval));
+                break;
+            case RematAddrGlobal:
+                func->push_stmt(new InstLoadAddrGlobal(tmpreg, rematval));
+                break;
+            case RematAddrStack:
+                func->push_stmt(new InstLoadAddrStack(tmpreg, spilloffset));
+                break;
+        }
         return tmpreg;
     } else {
         return reg;
@@ -22,7 +57,7 @@ Preg Vreg::get_stored_preg() {
 }
 
 void Vreg::store_onto_stack_if_needed(InstFuncDef *func) {
-    if(pos==VregInStack) {
+    if(pos==VregInStack) { // remat vars are never stored
         func->push_stmt(new InstStoreStack(spilloffset, PREG_STORE));
     }
 }
@@ -11,6 +11,7 @@ VREG+POOLED: tempvar
 VREG+POOLED(=REG): ref param
 VREG+POOLED: ref local scalar
 VREG(=STK): ref local array
+VREG(=REMAT): spilled pooled var, recomputed at each use
 =GLB: ref global
 
 */
@@ -64,20 +65,25 @@ struct Preg {
 
 struct Vreg {
     enum VregPos {
-        VregInStack, VregInReg
+        VregInStack, VregInReg, VregRemat
     } pos;
 
     int spillspan;
-    int spilloffset;
+    int spilloffset; // also stack idx for `RematAddrStack`
     Preg reg;
 
+    enum RematKind {
+        RematImm, RematAddrGlobal, RematAddrStack
+    } remat;
+    int rematval; // imm or global idx
+
 private:
     Vreg(bool instack):
-            pos(instack ? VregInStack : VregInReg), spillspan(0), spilloffset(-1), reg('x', 0) {}
+            pos(instack ? VregInStack : VregInReg), spillspan(0), spilloffset(-1), reg('x', 0), remat(RematImm), rematval(0) {}
 
 public:
     Vreg(Preg reg):
-            pos(VregInReg), spillspan(0), spilloffset(-1), reg(reg) {}
+            pos(VregInReg), spillspan(0), spilloffset(-1), reg(reg), remat(RematImm), rematval(0) {}
     static Vreg asReg(char cat, int index) {
         return {Preg(cat, index)};
     }
@@ -89,15 +95,25 @@ public:
         ret.spilloffset = offset;
         return ret;
     }
+    static Vreg asRemat(RematKind kind, int val) {
+        Vreg ret = Vreg(true);
+        ret.pos = VregRemat;
+        ret.remat = kind;
+        if(kind==RematAddrStack)
+            ret.spilloffset = val;
+        else
+            ret.rematval = val;
+        return ret;
+    }
 
     bool operator==(const Vreg &rhs) const {
-        return (
-            pos==rhs.pos &&
-            (pos==VregInReg ?
-                reg==rhs.reg :
-                (spilloffset==rhs.spilloffset)
-            )
-        );
+        if(pos!=rhs.pos)
+            return false;
+        if(pos==VregRemat)
+            return remat==rhs.remat && rematval==rhs.rematval && spilloffset==rhs.spilloffset;
+        return pos==VregInReg ?
+            reg==rhs.reg :
+            (spilloffset==rhs.spilloffset);
     }
     bool operator!=(const Vreg &rhs) const {
         return !(rhs == *this);
@@ -106,6 +122,8 @@ public:
         size_t operator()(const Vreg &v) const {
             if(v.pos==VregInReg)
                 return Preg::Hash()(v.reg);
+            else if(v.pos==VregRemat)
+                return v.rematval*7 + v.spilloffset;
             else
                 return -v.spilloffset;
         }
@@ -114,7 +132,16 @@ public:
     string analyzed_eeyore_ref() {
         if(pos==VregInReg)
             return reg.analyzed_eeyore_ref();
-        else {
+        else if(pos==VregRemat) {
+            char buf[32];
+            if(remat==RematImm)
+                sprintf(buf, "{remat %d}", rematval);
+            else if(remat==RematAddrGlobal)
+                sprintf(buf, "{remat &v%d}", rematval);
+            else
+                sprintf(buf, "{remat &stk #%d}", spilloffset);
+            return string(buf);
+        } else {
             char buf[32];
             if(spillspan == 1)
                 sprintf(buf, "{stk #%d}", spilloffset);
@@ -1,9 +1,11 @@
 #include "ir.hpp"
 #include "../front/ast.hpp"
 
+#include <algorithm>
 #include <queue>
 #include <stack>
 #include <unordered_set>
+using std::max;
 using std::queue;
 using std::stack;
 using std::unordered_set;
@@ -19,6 +21,12 @@ void clear_inqueue(IrFuncDef *func) {
 void propagate_alive_vars(IrFuncDef *func) {
     clear_inqueue(func);
 
+    // may be called again after stmts changed, stale sets would never shrink
+    for(const auto& stmtpair: func->stmts) {
+        stmtpair.first->alive_pooled_vars.clear();
+        stmtpair.first->meet_pooled_vars.clear();
+    }
+
     queue<IrStmt*> q;
 
     // push all stmts
@@ -176,15 +184,117 @@ CorrGraph collect_correlation(IrFuncDef *func) {
     return graph;
 }
 
-int get_sacrificed_node(CorrGraph graph) {
+unordered_map<int, Vreg> scan_rematerializable(IrFuncDef *func) {
+    // vars whose every def yields the same const or address can be recomputed instead of spilled
+    unordered_map<int, Vreg> remat;
+    unordered_set<int> failed;
+
+    for(const auto& stmtpair: func->stmts) {
+        auto stmt = stmtpair.first;
+        for(int def: stmt->defs()) {
+            bool ok = false;
+            Vreg vreg = Vreg(Preg('x', 0));
+
+            if(istype(stmt, IrMov) && ((IrMov*)stmt)->src.type==RVal::ConstExp) {
+                ok = true;
+                vreg = Vreg::asRemat(Vreg::RematImm, ((IrMov*)stmt)->src.val.constexp);
+            } else if(istype(stmt, IrOpBinary)) {
+                auto binstmt = (IrOpBinary*)stmt;
+                if(
+                    binstmt->op==OpPlus && binstmt->operand2.type==RVal::ConstExp &&
+                    binstmt->operand1.type==RVal::Reference && binstmt->operand1.val.reference->idxinfo->dims()>0
+                ) { // ptr = arr + const
+                    auto arrdef = binstmt->operand1.val.reference;
+                    int offset = binstmt->operand2.val.constexp;
+                    if(arrdef->pos==DefGlobal && offset==0) {
+                        ok = true;
+                        vreg = Vreg::asRemat(Vreg::RematAddrGlobal, arrdef->index);
+                    } else if(arrdef->pos==DefLocal && offset%4==0 && offset>=0) {
+                        ok = true;
+                        vreg = Vreg::asRemat(Vreg::RematAddrStack, func->get_vreg(binstmt->operand1).spilloffset + offset/4);
+                    }
+                }
+            }
+
+            auto it = remat.find(def);
+            if(!ok || (it!=remat.end() && it->second!=vreg))
+                failed.insert(def);
+            else if(it==remat.end())
+                remat.insert(make_pair(def, vreg));
+        }
+    }
+
+    for(int x: failed)
+        remat.erase(x);
+    return remat;
+}
+
+unordered_map<int, int> calc_spill_costs(IrFuncDef *func, const unordered_map<int, Vreg> &remat) {
+    // estimated extra insts if a var lives on stack: a load per use and a store per def,
+    // remat vars only recompute at uses, weighted by loop depth
+    const int MEMORY_COST = 2;
+    const int REMAT_COST = 1;
+
+    unordered_map<int, int> costs;
+    auto depths = func->loop_depths();
+
+    for(const auto& stmtpair: func->stmts) {
+        int weight = 1;
+        for(int d=0; d<depths[stmtpair.first] && d<6; d++)
+            weight *= 8;
+
+        for(int use: stmtpair.first->uses())
+            costs[use] += weight * (remat.find(use)!=remat.end() ? REMAT_COST : MEMORY_COST);
+        for(int def: stmtpair.first->defs())
+            if(remat.find(def)==remat.end())
+                costs[def] += weight * MEMORY_COST;
+    }
+    return costs;
+}
+
+int get_sacrificed_node(CorrGraph &graph, unordered_map<int, int> &costs) {
+    // cheapest var per interference edge removed
+    int best = 0;
+    double best_ratio = 0;
+    bool found = false;
+
     for(auto x: graph.nodes) {
         if(x>=REGUID_ARG_OFFSET) // never spilloffset args
             continue;
 
-        // todo: add heuristic here
-        return x;
+        double ratio = (double)costs[x] / (graph.degrees[x]+1);
+        if(!found || ratio<best_ratio) {
+            found = true;
+            best = x;
+            best_ratio = ratio;
+        }
+    }
+    assert(found);
+    return best;
+}
+
+void assign_spill_slots(CorrGraph &graph, const vector<int> &spilled, unordered_map<int, Vreg> &vreg_map, int &spillsize) {
+    // spilled vars are scalars, so color them with stack slots:
+    // two spilled vars share a slot unless they are alive at the same time
+    // (after coloring, `edges_removed` holds the whole interference graph)
+
+    unordered_map<int, int> slot_of;
+    for(int x: spilled) {
+        unordered_set<int> used_slots;
+        for(int y: graph.edges_removed[x]) {
+            auto it = slot_of.find(y);
+            if(it!=slot_of.end())
+                used_slots.insert(it->second);
+        }
+
+        int slot = 0;
+        while(used_slots.find(slot)!=used_slots.end())
+            slot++;
+
+        slot_of.insert(make_pair(x, slot));
+        vreg_map.insert(make_pair(x, Vreg::asStack(1, slot)));
+        spillsize = max(spillsize, slot+1);
     }
-    assert(false);
 }
 
 Preg choose_reg(CorrGraph graph, int x, vector<Preg> avail_regs, const unordered_map<int, Vreg> &vreg_map, Preg recommendation) {
@@ -239,6 +349,8 @@ void check_alloc_does_not_conflict(IrFuncDef *func) {
 
         for(auto uid: stmt.first->alive_pooled_vars) { // assert alive vars do not map to same vreg
             Vreg reg = func->get_vreg(uid);
+            if(reg.pos==Vreg::VregRemat) // holds no storage
+                continue;
             assert(workingset.find(reg)==workingset.end());
 
             workingset.insert(reg);
@@ -364,6 +476,8 @@ void IrFuncDef::regalloc() {
 
     // only `regpooled` (tempvar, arg, local scalar) vars in this graph
 
+    vector<pair<int, int>> local_arrays; // (totelems, reguid)
+
     for(const auto& declpair: decls) {
         if(declpair.first->def_or_null==nullptr) // skip tempvar
             continue;
@@ -373,15 +487,19 @@ void IrFuncDef::regalloc() {
 
         decl_map.insert(make_pair(reguid, declpair.first->def_or_null));
 
-        if(declpair.first->def_or_null->idxinfo->dims() > 0) {
-            // map local array -> stack
-            auto totelems = declpair.first->dest.val.reference->initval.totelems;
-            vreg_map.insert(make_pair(
-                reguid,
-                Vreg::asStack(totelems, spillsize)
-            ));
-            spillsize += totelems;
-        }
+        if(declpair.first->def_or_null->idxinfo->dims() > 0)
+            local_arrays.push_back(make_pair(declpair.first->dest.val.reference->initval.totelems, reguid));
+    }
+
+    // map local array -> stack, offset relative to array area (see `report_destroyed_set`)
+    // smaller arrays first, so that more of them can be addressed by immediate offsets
+    std::stable_sort(local_arrays.begin(), local_arrays.end());
+    for(auto arrpair: local_arrays) {
+        vreg_map.insert(make_pair(
+            arrpair.second,
+            Vreg::asStack(arrpair.first, arraysize)
+        ));
+        arraysize += arrpair.first;
     }
 
     vector<Preg> avail_regs;
@@ -395,10 +513,13 @@ void IrFuncDef::regalloc() {
         avail_regs.push_back(Preg('a', a));
 
     Recommender rec = scan_recommendations(this);
+    auto remat = scan_rematerializable(this);
+    auto spill_costs = calc_spill_costs(this, remat);
 
     // now colorize the graph
 
     stack<int> stk_colorable;
+    vector<int> spilled;
 
     while(!graph.nodes.empty()) {
         int x = graph.find_colorable_node(avail_regs.size());
@@ -409,17 +530,19 @@ void IrFuncDef::regalloc() {
 
         } else { // all nodes not colorable
             // remove one node
-            x = get_sacrificed_node(graph);
+            x = get_sacrificed_node(graph, spill_costs);
             graph.rmnode(x);
 
-            // map it onto stack
-            auto it = decl_map.find(x); // local -> found, tempvar -> notfound
-            int arrelems = it==decl_map.end() ? 1 : it->second->initval.totelems;
-            vreg_map.insert(make_pair(x, Vreg::asStack(arrelems, spillsize)));
-            spillsize += arrelems;
+            auto rit = remat.find(x);
+            if(rit!=remat.end()) // recompute at each use
+                vreg_map.insert(make_pair(x, rit->second));
+            else // map it onto stack later
+                spilled.push_back(x);
         }
     }
 
+    assign_spill_slots(graph, spilled, vreg_map, spillsize);
+
     while(!stk_colorable.empty()) { // for each colorable node
         int x = stk_colorable.top();
         stk_colorable.pop();
@@ -437,7 +560,8 @@ void IrFuncDef::regalloc() {
         Preg shouldbe = Preg('a', i);
         auto it = vreg_map.find(uid);
         if(it==vreg_map.end()) {
-            printf("warning: <%s> arg %d not used\n", name.c_str(), i);
+            if(substituted_params.find(i)==substituted_params.end())
+                printf("warning: <%s> arg %d not used\n", name.c_str(), i);
         } else {
             assert(it->second.pos==Vreg::VregInReg);
             if(it->second.reg != shouldbe) {
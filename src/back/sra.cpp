@@ -0,0 +1,80 @@
+#include <map>
+using std::map;
+
+#include "../main/common.hpp"
+#include "ir.hpp"
+#include "../front/ast.hpp"
+
+const int SRA_MAX_ELEMS = 8; // each element becomes a pooled scalar competing for regs
+
+static bool is_ref_to(RVal v, AstDef *def) {
+    return v.type==RVal::Reference && v.val.reference==def;
+}
+
+static bool splittable(IrFuncDef *func, AstDef *def) {
+    // only accessed through constant in-range offsets, never as a pointer
+    int bytes = def->initval.totelems*4;
+    for(const auto& stmtpair: func->stmts) {
+        auto stmt = stmtpair.first;
+        if(istype(stmt, IrArraySet) && is_ref_to(((IrArraySet*)stmt)->dest, def)) {
+            int off = ((IrArraySet*)stmt)->doffset;
+            if(off<0 || off>=bytes)
+                return false;
+        }
+        if(istype(stmt, IrArrayGet) && is_ref_to(((IrArrayGet*)stmt)->src, def)) {
+            int off = ((IrArrayGet*)stmt)->soffset;
+            if(off<0 || off>=bytes)
+                return false;
+            continue; // src is the only read val
+        }
+        for(auto val: stmt->read_vals())
+            if(is_ref_to(*val, def))
+                return false;
+    }
+    return true;
+}
+
+void IrFuncDef::split_local_arrays() {
+    /*
+     * small local arrays only indexed by constants, like `int d[4]` direction tables,
+     * become one tempvar per element, so they can live in regs instead of the stack:
+     *
+     * a [8] = x                    ->  t2 = x
+     * y = a [4]                    ->  y = t1
+     * fill a [0, 3) with 0         ->  t0 = 0, t1 = 0, t2 = 0
+     */
+    for(auto declit=decls.begin(); declit!=decls.end();) {
+        auto def = declit->first->def_or_null;
+        if(!def || def->pos!=DefLocal || def->idxinfo->dims()==0 || def->initval.totelems>SRA_MAX_ELEMS || !splittable(this, def)) {
+            declit++;
+            continue;
+        }
+
+        map<int, LVal> elems; // element idx -> tempvar
+        auto elem = [&](int idx) {
+            auto it = elems.find(idx);
+            if(it==elems.end())
+                it = elems.insert(make_pair(idx, gen_scalar_tempvar())).first;
+            return it->second;
+        };
+
+        for(auto it=stmts.begin(); it!=stmts.end(); it++) {
+            auto stmt = it->first;
+            if(istype(stmt, IrArraySet) && is_ref_to(((IrArraySet*)stmt)->dest, def)) {
+                auto setstmt = (IrArraySet*)stmt;
+                it->first = new IrMov(this, elem(setstmt->doffset/4), setstmt->src);
+            } else if(istype(stmt, IrArrayGet) && is_ref_to(((IrArrayGet*)stmt)->src, def)) {
+                auto getstmt = (IrArrayGet*)stmt;
+                it->first = new IrMov(this, getstmt->dest, elem(getstmt->soffset/4));
+            } else if(istype(stmt, IrLocalArrayFillZero) && is_ref_to(((IrLocalArrayFillZero*)stmt)->dest, def)) {
+                auto fillstmt = (IrLocalArrayFillZero*)stmt;
+                string comment = it->second;
+                it = stmts.erase(it);
+                for(int i=fillstmt->begin; i<fillstmt->begin+fillstmt->count; i++)
+                    stmts.insert(it, make_pair(new IrMov(this, elem(i), RVal::asConstExp(0)), comment));
+                it--;
+            }
+        }
+        declit = decls.erase(declit);
+    }
+}
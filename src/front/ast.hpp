@@ -126,6 +126,7 @@ struct AstDef: Ast {
     AstDef(string var_name, AstMaybeIdx *idxinfo, AstInitVal *ast_initval):
             name(var_name), idxinfo(idxinfo), ast_initval_or_null(ast_initval), initval(),
             type(VarInt), effectively_const(true), ast_is_const(false), pos(DefUnknown), index(-1) {}
+    static int gen_index();
     void calc_initval();
     void gen_ir_decl(IrDeclContainer *cont);
     void gen_ir_init_local(IrFuncDef *func);
@@ -181,6 +182,7 @@ struct AstFuncDef: Ast {
         type(type), name(func_name), params(params), body(body) {}
     void gen_ir(IrRoot *root);
     asthash_t asthash() override;
+    asthash_t canonical_hash(); // invariant to renaming params and locals
 };
 
 struct AstFuncDefParams: Ast {
@@ -266,6 +268,7 @@ struct AstStmtIfOnly: AstStmt {
     AstStmtIfOnly(AstExp *cond, AstStmt *body): AstStmt(StmtIfOnly),
         cond(cond), body(body) {}
     void gen_ir(IrFuncDef *func) override;
+    bool gen_ir_select(IrFuncDef *func); // if_conversion.cpp
     asthash_t asthash() override;
 };
 
@@ -277,6 +280,8 @@ struct AstStmtIfElse: AstStmt {
     AstStmtIfElse(AstExp *cond, AstStmt *body_true, AstStmt *body_false): AstStmt(StmtIfElse),
         cond(cond), body_true(body_true), body_false(body_false) {}
     void gen_ir(IrFuncDef *func) override;
+    bool gen_ir_select(IrFuncDef *func); // if_conversion.cpp
+    bool gen_ir_chain(IrFuncDef *func); // compare_chain.cpp
     asthash_t asthash() override;
 };
 
@@ -291,6 +296,9 @@ struct AstStmtWhile: AstStmt {
     AstStmtWhile(AstExp *cond, AstStmt *body): AstStmt(StmtWhile),
         cond(cond), body(body), ltest(-1), ldone(-1) {}
     void gen_ir(IrFuncDef *func) override;
+    bool gen_ir_idiom(IrFuncDef *func); // idiom.cpp
+    bool gen_ir_interchanged(IrFuncDef *func); // interchange.cpp
+    bool gen_ir_promoted(IrFuncDef *func); // scalar_promotion.cpp
     asthash_t asthash() override;
 };
 
@@ -339,6 +347,7 @@ public:
 
     virtual ConstExpResult calc_const() = 0;
     virtual RVal gen_rval(IrFuncDef *func) = 0; // return tmp label
+    virtual void gen_cond(IrFuncDef *func, int ltrue, int lfalse); // branch on value, label -1 for falling through
     ConstExpResult get_const() {
         if(!const_calculated) {
             const_cache = calc_const();
@@ -356,11 +365,15 @@ struct AstExpLVal: AstExp {
     AstDef *def;
     int dim_left;
 
+    // in gen ir phase, tempvar holding this array element while in a loop, or -1
+    int promoted;
+
     AstExpLVal(string name, AstMaybeIdx *idxinfo):
         name(name), idxinfo(idxinfo),
-        def(nullptr), dim_left(-1) {}
+        def(nullptr), dim_left(-1), promoted(-1) {}
     ConstExpResult calc_const() override;
     RVal gen_rval(IrFuncDef *func) override;
+    void gen_store(IrFuncDef *func, RVal val);
     asthash_t asthash() override;
 };
 
@@ -396,6 +409,7 @@ struct AstExpOpUnary: AstExp {
         op(op), operand(operand) {}
     ConstExpResult calc_const() override;
     RVal gen_rval(IrFuncDef *func) override;
+    void gen_cond(IrFuncDef *func, int ltrue, int lfalse) override;
     asthash_t asthash() override;
 };
 
@@ -408,5 +422,6 @@ struct AstExpOpBinary: AstExp {
         op(op), operand1(operand1), operand2(operand2) {}
     ConstExpResult calc_const() override;
     RVal gen_rval(IrFuncDef *func) override;
+    void gen_cond(IrFuncDef *func, int ltrue, int lfalse) override;
     asthash_t asthash() override;
 };
\ No newline at end of file
@@ -46,6 +46,12 @@ ConstExpResult do_binary_op(BinaryOpKinds op, int val1, int val2) {
             return val1&&val2;
         case OpOr:
             return val1||val2;
+        case OpBitAnd:
+            return val1&val2;
+        case OpBitOr:
+            return val1|val2;
+        case OpBitXor:
+            return val1^val2;
         default:
             assert(false); return ConstExpResult::asError("impossible");
     }
@@ -1,11 +1,30 @@
 #include <functional>
+#include <unordered_map>
 using std::hash;
+using std::unordered_map;
 
 #include "ast.hpp"
 
 static hash<string> hstr;
 static hash<int> hint;
 
+/*
+ * in canonical mode, params and locals are hashed by the order they are met instead
+ * of their names, so renaming them keeps the hash; globals and callees keep names
+ */
+static bool canonical_mode = false;
+static unordered_map<AstDef*, int> canonical_ids;
+
+static asthash_t hdef(AstDef *def) {
+    if(!canonical_mode || def->pos==DefGlobal)
+        return hstr(def->name);
+
+    auto it = canonical_ids.find(def);
+    if(it==canonical_ids.end())
+        it = canonical_ids.insert(make_pair(def, (int)canonical_ids.size())).first;
+    return hstr("local") + hint(it->second);
+}
+
 template<typename T>
 static asthash_t hvec(vector<T> v) {
     asthash_t ret = hint(v.size());
@@ -24,7 +43,7 @@ asthash_t AstDefs::asthash() {
 
 asthash_t AstDef::asthash() {
     return hstr("def") +  (
-        hint(type) + hint(ast_is_const) + hstr(name) +
+        hint(type) + hint(ast_is_const) + hdef(this) +
         idxinfo->asthash() + (ast_initval_or_null ? ast_initval_or_null->asthash() : hstr("null"))
     );
 }
@@ -43,6 +62,14 @@ asthash_t AstFuncDef::asthash() {
     return hstr("func") + hint(type) + params->asthash() + body->asthash();
 }
 
+asthash_t AstFuncDef::canonical_hash() {
+    canonical_mode = true;
+    canonical_ids.clear();
+    asthash_t ret = asthash();
+    canonical_mode = false;
+    return ret;
+}
+
 
 asthash_t AstFuncDefParams::asthash() {
     return hstr("defp") + hvec(val);
@@ -102,7 +129,7 @@ asthash_t AstStmtReturn::asthash() {
 }
 
 asthash_t AstExpLVal::asthash() {
-    return hstr("lval") + hstr(name) + idxinfo->asthash();
+    return hstr("lval") + (def ? hdef(def) : hstr(name)) + idxinfo->asthash();
 }
 
 asthash_t AstExpLiteral::asthash() {
@@ -16,13 +16,17 @@ void AstBlock::push_val(Ast *next) {
 
 ///// propagate
 
-void AstDecl::propagate_property() {
+int AstDef::gen_index() {
     static int idx = 0; // global and local vars share same indexing in eeyore
+    return idx++;
+}
+
+void AstDecl::propagate_property() {
     for(AstDef *def: defs->val) {
         def->type = _type;
         def->ast_is_const = _is_const;
         def->effectively_const = true;
-        def->index = idx++;
+        def->index = AstDef::gen_index();
     }
 }
 
@@ -205,24 +205,71 @@ void IrFuncDefSet::report_destroyed_set() {
 }
 
 
+/*
+ * kernel registry: a function is replaced by a kernel if
+ *  - its name and exact `asthash` match a known function, or
+ *  - its `canonical_hash` is listed in the file named by $ATOZ_KERNEL_REGISTRY,
+ *    one `<hash in hex> <kernel>` per line, so renamed copies can be added without recompiling
+ * set OUTPUT_ASTHASH to print the hashes of every function
+ */
+struct BuiltinKernel {
+    string kernel;
+    int nparams;
+    string known_name;
+    asthash_t known_hash;
+    IrFuncDefBuiltin *(*create)(IrFuncDef *ir);
+};
+
+const BuiltinKernel BUILTIN_KERNELS[] = {
+    {"memcpy", 4, "memmove", HASH_MEMCPY, [](IrFuncDef *ir) -> IrFuncDefBuiltin* {
+        return new IrFuncDefMemcpy(ir->root, ir->type, ir->name, ir->params);
+    }},
+    {"mul", 2, "multiply", HASH_MUL, [](IrFuncDef *ir) -> IrFuncDefBuiltin* {
+        return new IrFuncDefMul(ir->root, ir->type, ir->name, ir->params);
+    }},
+    {"set", 3, "set", HASH_SET, [](IrFuncDef *ir) -> IrFuncDefBuiltin* {
+        return new IrFuncDefSet(ir->root, ir->type, ir->name, ir->params);
+    }},
+};
+
+inline const unordered_map<asthash_t, string> &kernel_registry() {
+    static unordered_map<asthash_t, string> registry;
+    static bool loaded = false;
+    if(loaded)
+        return registry;
+    loaded = true;
+
+    const char *path = getenv("ATOZ_KERNEL_REGISTRY");
+    FILE *f = path ? fopen(path, "r") : nullptr;
+    if(!f)
+        return registry;
+
+    unsigned long long hash;
+    char kernel[64];
+    while(fscanf(f, "%llx %63s", &hash, kernel)==2)
+        registry[hash] = kernel;
+    fclose(f);
+    return registry;
+}
+
 inline IrFuncDefBuiltin *create_builtin_wrapper(AstFuncDef *ast, IrFuncDef *ir) {
     static_assert(sizeof(asthash_t)==8, "use 64-bit!");
     if(!DO_DETECT_BUILTIN)
         return nullptr;
 
     asthash_t hash = ast->asthash();
+    asthash_t canonical = ast->canonical_hash();
     if(OUTPUT_ASTHASH)
-        printf("hash of `%s` = %llx\n", ast->name.c_str(), hash);
+        printf("hash of `%s` = %llx, canonical = %llx\n", ast->name.c_str(), hash, canonical);
 
-    if(ast->name=="memmove" && hash==HASH_MEMCPY) {
-        printf("info: got builtin memcpy: %s\n", ast->name.c_str());
-        return new IrFuncDefMemcpy(ir->root, ir->type, ir->name, ir->params);
-    } else if(ast->name=="multiply" && hash==HASH_MUL) {
-        printf("info: got builtin mul: %s\n", ast->name.c_str());
-        return new IrFuncDefMul(ir->root, ir->type, ir->name, ir->params);
-    } else if(ast->name=="set" && hash==HASH_SET) {
-        printf("info: got builtin set: %s\n", ast->name.c_str());
-        return new IrFuncDefSet(ir->root, ir->type, ir->name, ir->params);
+    auto it = kernel_registry().find(canonical);
+    for(const auto &kernel: BUILTIN_KERNELS) {
+        bool known = ast->name==kernel.known_name && hash==kernel.known_hash;
+        bool registered = it!=kernel_registry().end() && it->second==kernel.kernel;
+        if((known || registered) && ast->type==FuncInt && (int)ast->params->val.size()==kernel.nparams) {
+            printf("info: got builtin %s: %s\n", kernel.kernel.c_str(), ast->name.c_str());
+            return kernel.create(ir);
+        }
     }
     return nullptr;
-}
\ No newline at end of file
+}
@@ -209,6 +209,14 @@ void IrGoto::output_eeyore(list<string> &buf) {
     outstmt("goto l%d", label);
 }
 
+void IrTableGoto::output_eeyore(list<string> &buf) {
+    // eeyore does not support this
+    string targets;
+    for(int label: labels)
+        targets += " l" + std::to_string(label);
+    outstmt("!! goto table l%d [%s ] by %s", table, targets.c_str(), eey(operand));
+}
+
 void IrLabel::output_eeyore(list<string> &buf) {
     outstmt("l%d:", label);
 }
@@ -256,7 +264,7 @@ void IrLabelReturn::output_eeyore(list<string> &buf) {
 */
 
 void IrLocalArrayFillZero::output_eeyore(list<string> &buf) {
-    outstmt("//[ local_array_fill_zero %s ]", eey(dest));
+    outstmt("//[ local_array_fill_zero %s %d..%d ]", eey(dest), begin, begin+count-1);
 }
 
 #undef eey
\ No newline at end of file
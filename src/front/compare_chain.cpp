@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <unordered_set>
+using std::sort;
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ast.hpp"
+
+/*
+ * `if(x == K1) .. else if(x == K2) .. else ..` chains on one scalar are dispatched at once,
+ * instead of testing each constant in turn:
+ *
+ *     if x < min goto ldefault     <- dense: bounds check, then one indirect jump
+ *     if x > max goto ldefault
+ *     t = x - min
+ *     goto table [t]
+ *
+ *     if x >= K3 goto lright       <- sparse: balanced decision tree on the sorted constants,
+ *     if x == K1 goto lcase1          short runs compared one by one
+ *     ..
+ *
+ * a later arm testing an already seen constant can never run, and is dropped
+ */
+
+bool JUMP_TABLES = true; // needs an indirect jump, only in riscv output
+
+const int CHAIN_MIN_CASES = 6; // shorter chains are as fast compared one by one, hot cases usually come first
+const int JUMP_TABLE_MIN_CASES = 8; // bounds check, sub and the table load cost about 4 compares
+const int JUMP_TABLE_MAX_HOLES = 1; // table slots not hit per case, these go to the default
+const int DECISION_LEAF_CASES = 4; // compared one by one at the leaves of the tree
+
+struct ChainCase {
+    int val;
+    AstStmt *body;
+    int label;
+};
+
+static AstExpLVal *compared_scalar_or_null(AstExp *cond, int &val) {
+    // `x == K` or `K == x`, x a scalar var, or an element kept in a tempvar
+    if(!istype(cond, AstExpOpBinary) || ((AstExpOpBinary*)cond)->op!=OpEq)
+        return nullptr;
+    auto operand1 = ((AstExpOpBinary*)cond)->operand1, operand2 = ((AstExpOpBinary*)cond)->operand2;
+    if(!operand1->get_const().iserror)
+        std::swap(operand1, operand2);
+    if(!istype(operand1, AstExpLVal) || !operand1->get_const().iserror || operand2->get_const().iserror)
+        return nullptr;
+
+    auto lval = (AstExpLVal*)operand1;
+    if(lval->promoted<0 && (!lval->idxinfo->val.empty() || lval->def->idxinfo->dims()>0))
+        return nullptr;
+    val = operand2->get_const().val;
+    return lval;
+}
+
+static void gen_decision_tree(IrFuncDef *func, RVal x, const vector<ChainCase> &cases, int lo, int hi, int ldefault) {
+    // cases [lo, hi), sorted by val
+    if(hi-lo<=DECISION_LEAF_CASES) {
+        for(int i=lo; i<hi; i++)
+            func->push_stmt(new IrCondGoto(func, x, RelEq, RVal::asConstExp(cases[i].val), cases[i].label), "chain - case");
+        func->push_stmt(new IrGoto(func, ldefault), "chain - no case");
+        return;
+    }
+
+    int mid = (lo+hi)/2;
+    int lright = func->gen_label();
+    func->push_stmt(new IrCondGoto(func, x, RelGeq, RVal::asConstExp(cases[mid].val), lright), "chain - split");
+    gen_decision_tree(func, x, cases, lo, mid, ldefault);
+    func->push_stmt(new IrLabel(func, lright), "chain - lright");
+    gen_decision_tree(func, x, cases, mid, hi, ldefault);
+}
+
+bool AstStmtIfElse::gen_ir_chain(IrFuncDef *func) {
+    vector<ChainCase> cases; // in chain order
+    unordered_set<int> seen;
+    AstExpLVal *scalar = nullptr;
+    AstStmt *default_or_null = nullptr;
+
+    AstStmt *stmt = this;
+    while(true) {
+        AstExp *cond = nullptr;
+        if(istype(stmt, AstStmtIfElse))
+            cond = ((AstStmtIfElse*)stmt)->cond;
+        else if(istype(stmt, AstStmtIfOnly))
+            cond = ((AstStmtIfOnly*)stmt)->cond;
+
+        int val;
+        AstExpLVal *lval = cond ? compared_scalar_or_null(cond, val) : nullptr;
+        if(!lval || (scalar && (lval->def!=scalar->def || lval->promoted!=scalar->promoted))) {
+            default_or_null = stmt;
+            break;
+        }
+        scalar = lval;
+
+        bool is_else = istype(stmt, AstStmtIfElse);
+        AstStmt *body = is_else ? ((AstStmtIfElse*)stmt)->body_true : ((AstStmtIfOnly*)stmt)->body;
+        if(seen.insert(val).second)
+            cases.push_back({val, body, -1});
+        if(!is_else)
+            break;
+        stmt = ((AstStmtIfElse*)stmt)->body_false;
+    }
+    if((int)cases.size()<CHAIN_MIN_CASES)
+        return false;
+
+    RVal x = scalar->gen_rval(func);
+    if(x.type==RVal::Reference && x.val.reference->pos==DefGlobal) {
+        // read once, not on every compare
+        LVal t = func->gen_scalar_tempvar();
+        func->push_stmt(new IrMov(func, t, x), "chain - scalar");
+        x = t;
+    }
+
+    for(auto &c: cases)
+        c.label = func->gen_label();
+    int ldefault = func->gen_label();
+    int ldone = func->gen_label();
+
+    vector<ChainCase> sorted = cases;
+    sort(sorted.begin(), sorted.end(), [](const ChainCase &a, const ChainCase &b) {
+        return a.val<b.val;
+    });
+    int n = sorted.size();
+    long long range = (long long)sorted[n-1].val - sorted[0].val + 1;
+
+    if(JUMP_TABLES && n>=JUMP_TABLE_MIN_CASES && range<=(long long)n*(1+JUMP_TABLE_MAX_HOLES)) {
+        int min = sorted[0].val, max = sorted[n-1].val;
+        func->push_stmt(new IrCondGoto(func, x, RelLess, RVal::asConstExp(min), ldefault), "chain - below table");
+        func->push_stmt(new IrCondGoto(func, x, RelGreater, RVal::asConstExp(max), ldefault), "chain - above table");
+
+        RVal idx = x;
+        if(min!=0) {
+            LVal t = func->gen_scalar_tempvar();
+            func->push_stmt(new IrOpBinary(func, t, x, OpMinus, RVal::asConstExp(min)), "chain - table idx");
+            idx = t;
+        }
+
+        vector<int> labels(range, ldefault);
+        for(const auto &c: sorted)
+            labels[c.val-min] = c.label;
+        func->push_stmt(new IrTableGoto(func, idx, labels, func->gen_label()), "chain - table");
+    } else {
+        gen_decision_tree(func, x, sorted, 0, n, ldefault);
+    }
+
+    for(const auto &c: cases) {
+        func->push_stmt(new IrLabel(func, c.label), "chain - lcase");
+        c.body->gen_ir(func);
+        func->push_stmt(new IrGoto(func, ldone), "chain - case done");
+    }
+    func->push_stmt(new IrLabel(func, ldefault), "chain - ldefault");
+    if(default_or_null)
+        default_or_null->gen_ir(func);
+    func->push_stmt(new IrLabel(func, ldone), "chain - ldone");
+    return true;
+}
@@ -35,7 +35,8 @@ enum UnaryOpKinds {
 enum BinaryOpKinds {
     OpPlus, OpMinus, OpMul, OpDiv, OpMod, // + - * / %
     OpLess, OpGreater, OpLeq, OpGeq, OpEq, OpNeq, // < > <= >= == !=
-    OpAnd, OpOr // && ||
+    OpAnd, OpOr, // && ||
+    OpBitAnd, OpBitOr, OpBitXor // & | ^, only made by passes for asm output
 };
 
 enum RelKinds { // can be represented by asm
@@ -112,6 +113,9 @@ inline string cvt_from_binary(BinaryOpKinds op) {
         case OpNeq: return "!=";
         case OpAnd: return "&&";
         case OpOr: return "||";
+        case OpBitAnd: return "&";
+        case OpBitOr: return "|";
+        case OpBitXor: return "^";
         default: assert(false); return "";
     }
 }
@@ -149,6 +153,9 @@ inline RelKinds cvt_to_rel(BinaryOpKinds op) {
         case OpMod:
         case OpAnd:
         case OpOr:
+        case OpBitAnd:
+        case OpBitOr:
+        case OpBitXor:
         default:
             return NotARel;
     }
@@ -174,6 +181,38 @@ inline RelKinds rel_invert(RelKinds op) {
     }
 }
 
+inline RelKinds rel_swap(RelKinds op) { // a op b  <=>  b rel_swap(op) a
+    switch(op) {
+        case RelLess:
+            return RelGreater;
+        case RelGreater:
+            return RelLess;
+        case RelLeq:
+            return RelGeq;
+        case RelGeq:
+            return RelLeq;
+        case RelEq:
+            return RelEq;
+        case RelNeq:
+            return RelNeq;
+        case NotARel:
+        default:
+            return NotARel;
+    }
+}
+
+inline BinaryOpKinds cvt_to_binary(RelKinds op) {
+    switch(op) {
+        case RelLess: return OpLess;
+        case RelGreater: return OpGreater;
+        case RelLeq: return OpLeq;
+        case RelGeq: return OpGeq;
+        case RelEq: return OpEq;
+        case RelNeq: return OpNeq;
+        default: assert(false);
+    }
+}
+
 // def position
 
 enum DefPosition { DefUnknown, DefGlobal, DefLocal, DefArg };
@@ -67,7 +67,17 @@ void AstDef::gen_ir_init_local(IrFuncDef *func) {
         }
     } else { // array
         if(ast_initval_or_null!=nullptr) {
-            func->push_stmt(new IrLocalArrayFillZero(func, this));
+            // only zero the gaps between initialized elements
+            for(int i=0; i<initval.totelems;) {
+                if(initval.value[i] != nullptr) {
+                    i++;
+                    continue;
+                }
+                int begin = i;
+                while(i<initval.totelems && initval.value[i] == nullptr)
+                    i++;
+                func->push_stmt(new IrLocalArrayFillZero(func, this, begin, i-begin));
+            }
 
             for(int i=0; i<initval.totelems; i++)
                 if(initval.value[i] != nullptr) {
@@ -108,6 +118,8 @@ void AstFuncDef::gen_ir(IrRoot *root) {
 }
 
 void AstFuncUseParams::gen_ir(IrFuncDef *func) {
+    generated_irs.clear(); // gen again if the call is emitted more than once, e.g. in a loop cond
+
     vector<RVal> gen_params;
     for(auto *param: val) {
         auto *lval = dynamic_cast<AstExpLVal*>(param); // maybe it is an array
@@ -146,25 +158,30 @@ void AstBlock::gen_ir(IrFuncDef *func) {
 
 void AstStmtAssignment::gen_ir(IrFuncDef *func) {
     RVal val = rval->gen_rval(func);
+    lval->gen_store(func, val);
+}
 
-    if(lval->dim_left!=0)
-        generror("assignment lval got dim %d for var %s", lval->dim_left, lval->name.c_str());
+void AstExpLVal::gen_store(IrFuncDef *func, RVal val) {
+    if(dim_left!=0)
+        generror("assignment lval got dim %d for var %s", dim_left, name.c_str());
 
-    if(!lval->idxinfo->val.empty()) { // has array index
-        AstExp *off = lval->def->initval.get_offset_bytes(lval->idxinfo, true);
+    if(promoted>=0) { // element kept in a tempvar by the enclosing loop
+        func->push_stmt(new IrMov(func, LVal::asTempVar(promoted), val), "promoted elem");
+    } else if(!idxinfo->val.empty()) { // has array index
+        AstExp *off = def->initval.get_offset_bytes(idxinfo, true);
 
         if (!off->get_const().iserror && !imm_overflows(off->get_const().val)) { // constant index
-            func->push_stmt(new IrArraySet(func, lval->def, off->get_const().val, val));
+            func->push_stmt(new IrArraySet(func, def, off->get_const().val, val));
         } else { // not constant index or overflows, do pointer calculation
             RVal toff = off->gen_rval(func);
             LVal ptr = func->gen_scalar_tempvar();
-            func->push_stmt(new IrOpBinary(func, ptr, lval->def, OpPlus, toff));
+            func->push_stmt(new IrOpBinary(func, ptr, def, OpPlus, toff));
             //outasm("%c%d [%s] = %s // assign", cdef(lval->def_or_null), lval->def_or_null->index, tlidx.eeyore_ref(), trval.eeyore_ref_local());
             func->push_stmt(new IrArraySet(func, ptr, 0, val));
         }
     } else { // plain value
         //outasm("%c%d = %s // assign", cdef(lval->def_or_null), lval->def_or_null->index, trval.eeyore_ref_local());
-        func->push_stmt(new IrMov(func, lval->def, val));
+        func->push_stmt(new IrMov(func, def, val));
     }
 }
 
@@ -181,11 +198,11 @@ void AstStmtBlock::gen_ir(IrFuncDef *func) {
 }
 
 void AstStmtIfOnly::gen_ir(IrFuncDef *func) {
-    RVal tcond = cond->gen_rval(func);
+    if(gen_ir_select(func))
+        return;
 
     int lskip = func->gen_label();
-    //outasm("if %s == 0 goto l%d // ifonly", tcond.eeyore_ref_local(), lskip);
-    func->push_stmt(new IrCondGoto(func, tcond, RelEq, RVal::asConstExp(0), lskip), "ifonly");
+    cond->gen_cond(func, -1, lskip);
 
     body->gen_ir(func);
     //outasm("l%d: // ifonly - lskip", lskip);
@@ -193,11 +210,11 @@ void AstStmtIfOnly::gen_ir(IrFuncDef *func) {
 }
 
 void AstStmtIfElse::gen_ir(IrFuncDef *func) {
-    RVal tcond = cond->gen_rval(func);
+    if(gen_ir_select(func) || gen_ir_chain(func))
+        return;
 
     int lfalse = func->gen_label();
-    //outasm("if %s == 0 goto l%d // ifelse", tcond.eeyore_ref_local(), lfalse);
-    func->push_stmt(new IrCondGoto(func, tcond, RelEq, RVal::asConstExp(0), lfalse), "ifelse");
+    cond->gen_cond(func, -1, lfalse);
 
     body_true->gen_ir(func);
     int ldone = func->gen_label();
@@ -213,19 +230,32 @@ void AstStmtIfElse::gen_ir(IrFuncDef *func) {
 }
 
 void AstStmtWhile::gen_ir(IrFuncDef *func) {
+    /*
+     * rotated into a guarded do-while, one branch per iteration:
+     *
+     *     if !cond goto ldone
+     * lbody:
+     *     body
+     * ltest:                       <- continue
+     *     if cond goto lbody
+     * ldone:                       <- break
+     */
+    if(gen_ir_idiom(func) || gen_ir_interchanged(func) || gen_ir_promoted(func))
+        return;
+
+    int lbody = func->gen_label();
     ltest = func->gen_label();
     ldone = func->gen_label();
 
+    cond->gen_cond(func, -1, ldone);
+    //outasm("l%d: // while - lbody", lbody);
+    func->push_stmt(new IrLabel(func, lbody), "while - lbody");
+
+    body->gen_ir(func);
     //outasm("l%d: // while - ltest", ltest);
     func->push_stmt(new IrLabel(func, ltest), "while - ltest");
 
-    RVal tcond = cond->gen_rval(func);
-    //outasm("if %s == 0 goto l%d // while - done", tcond.eeyore_ref_local(), ldone);
-    func->push_stmt(new IrCondGoto(func, tcond, RelEq, RVal::asConstExp(0), ldone), "while - done");
-
-    body->gen_ir(func);
-    //outasm("goto l%d // while - totest", ltest);
-    func->push_stmt(new IrGoto(func, ltest), "while - to test");
+    cond->gen_cond(func, lbody, -1);
     //outasm("l%d: // while - ldone", ldone);
     func->push_stmt(new IrLabel(func, ldone), "while - ldone");
 }
@@ -259,6 +289,10 @@ RVal AstExpLVal::gen_rval(IrFuncDef *func) {
         return RVal::asConstExp(get_const().val);
     }
 
+    if(promoted>=0) { // element kept in a tempvar by the enclosing loop
+        return RVal::asTempVar(promoted);
+    }
+
     if(!def->idxinfo->val.empty()) { // array
         LVal tval = func->gen_scalar_tempvar();
         AstExp *off = def->initval.get_offset_bytes(idxinfo, false);
@@ -351,45 +385,18 @@ RVal AstExpOpBinary::gen_rval(IrFuncDef *func) {
     LVal tret = func->gen_scalar_tempvar();
 
     RVal top1 = RVal::asConstExp(0), top2 = RVal::asConstExp(0);
-    int lskip;
-    
-    // these ops will shortcircuit
-    if(op==OpAnd) {
-        //outasm("t%d = 0 // op and - default value", tret);
-        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(0)), "op and - default value");
-        lskip = func->gen_label();
-
-        top1 = operand1->gen_rval(func);
-        //outasm("if %s == 0 goto l%d // op and - test 1", top1.eeyore_ref_local(), lskip);
-        func->push_stmt(new IrCondGoto(func, top1, RelEq, RVal::asConstExp(0), lskip), "op and - test 1");
-
-        top2 = operand2->gen_rval(func);
-        //outasm("if %s == 0 goto l%d // op and - test 2", top2.eeyore_ref_local(), lskip);
-        func->push_stmt(new IrCondGoto(func, top2, RelEq, RVal::asConstExp(0), lskip), "op and - test 2");
-
-        //outasm("t%d = 1 // op and - pass test", tret);
-        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(1)), "op and - passed test");
-        //outasm("l%d: // op and - lskip", lskip);
-        func->push_stmt(new IrLabel(func, lskip), "op and - lskip");
-        return tret;
 
-    } else if(op==OpOr) {
-        //outasm("t%d = 1 // op or - default value", tret);
-        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(1)), "op or - default value");
-        lskip = func->gen_label();
-
-        top1 = operand1->gen_rval(func);
-        //outasm("if %s != 0 goto l%d // op or - test 1", top1.eeyore_ref_local(), lskip);
-        func->push_stmt(new IrCondGoto(func, top1, RelNeq, RVal::asConstExp(0), lskip), "op or - test 1");
-
-        top2 = operand2->gen_rval(func);
-        //outasm("if %s != 0 goto l%d // op or - test 2", top2.eeyore_ref_local(), lskip);
-        func->push_stmt(new IrCondGoto(func, top2, RelNeq, RVal::asConstExp(0), lskip), "op or - test 2");
-
-        //outasm("t%d = 0 // op or - pass test", tret);
-        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(0)), "op or - passed test");
-        //outasm("l%d: // op or - lskip", lskip);
-        func->push_stmt(new IrLabel(func, lskip), "op or - lskip");
+    // these ops will shortcircuit
+    if(op==OpAnd || op==OpOr) {
+        int lfalse = func->gen_label();
+
+        //outasm("t%d = 0 // op and/or - default value", tret);
+        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(0)), "op and/or - default value");
+        gen_cond(func, -1, lfalse);
+        //outasm("t%d = 1 // op and/or - pass test", tret);
+        func->push_stmt(new IrMov(func, tret, RVal::asConstExp(1)), "op and/or - passed test");
+        //outasm("l%d: // op and/or - lfalse", lfalse);
+        func->push_stmt(new IrLabel(func, lfalse), "op and/or - lfalse");
         return tret;
     }
 
@@ -405,3 +412,80 @@ RVal AstExpOpBinary::gen_rval(IrFuncDef *func) {
     func->push_stmt(new IrOpBinary(func, tret, top1, op, top2));
     return tret;
 }
+
+// emit `if op1 rel op2 goto ltrue else goto lfalse`, where one label may be -1 for falling through
+static void gen_branch(IrFuncDef *func, RVal operand1, RelKinds rel, RVal operand2, int ltrue, int lfalse) {
+    if(lfalse==-1) {
+        func->push_stmt(new IrCondGoto(func, operand1, rel, operand2, ltrue), "cond - true");
+    } else if(ltrue==-1) {
+        func->push_stmt(new IrCondGoto(func, operand1, rel_invert(rel), operand2, lfalse), "cond - false");
+    } else {
+        func->push_stmt(new IrCondGoto(func, operand1, rel, operand2, ltrue), "cond - true");
+        func->push_stmt(new IrGoto(func, lfalse), "cond - false");
+    }
+}
+
+void AstExp::gen_cond(IrFuncDef *func, int ltrue, int lfalse) {
+    assert(ltrue!=-1 || lfalse!=-1);
+
+    if(!get_const().iserror) {
+        int target = get_const().val ? ltrue : lfalse;
+        if(target!=-1)
+            func->push_stmt(new IrGoto(func, target), "cond - const");
+        return;
+    }
+
+    RVal tcond = gen_rval(func);
+    if(tcond.type == RVal::TempVar && tcond.val.tempvar < 0)
+        generror("cond not primitive");
+    gen_branch(func, tcond, RelNeq, RVal::asConstExp(0), ltrue, lfalse);
+}
+
+void AstExpOpUnary::gen_cond(IrFuncDef *func, int ltrue, int lfalse) {
+    if(op==OpNot && get_const().iserror)
+        operand->gen_cond(func, lfalse, ltrue);
+    else
+        AstExp::gen_cond(func, ltrue, lfalse);
+}
+
+void AstExpOpBinary::gen_cond(IrFuncDef *func, int ltrue, int lfalse) {
+    if(!get_const().iserror) {
+        AstExp::gen_cond(func, ltrue, lfalse);
+        return;
+    }
+
+    if(op==OpAnd) {
+        // a false: done; a true: test b
+        if(lfalse==-1) {
+            int lskip = func->gen_label();
+            operand1->gen_cond(func, -1, lskip);
+            operand2->gen_cond(func, ltrue, -1);
+            func->push_stmt(new IrLabel(func, lskip), "cond and - lskip");
+        } else {
+            operand1->gen_cond(func, -1, lfalse);
+            operand2->gen_cond(func, ltrue, lfalse);
+        }
+    } else if(op==OpOr) {
+        // a true: done; a false: test b
+        if(ltrue==-1) {
+            int lskip = func->gen_label();
+            operand1->gen_cond(func, lskip, -1);
+            operand2->gen_cond(func, -1, lfalse);
+            func->push_stmt(new IrLabel(func, lskip), "cond or - lskip");
+        } else {
+            operand1->gen_cond(func, ltrue, -1);
+            operand2->gen_cond(func, ltrue, lfalse);
+        }
+    } else if(cvt_to_rel(op)!=NotARel) {
+        RVal top1 = operand1->gen_rval(func);
+        RVal top2 = operand2->gen_rval(func);
+        if(top1.type == RVal::TempVar && top1.val.tempvar < 0)
+            generror("binary operand1 not primitive");
+        if(top2.type == RVal::TempVar && top2.val.tempvar < 0)
+            generror("binary operand2 not primitive");
+
+        gen_branch(func, top1, cvt_to_rel(op), top2, ltrue, lfalse);
+    } else {
+        AstExp::gen_cond(func, ltrue, lfalse);
+    }
+}
@@ -0,0 +1,387 @@
+#include <unordered_set>
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ast.hpp"
+
+/*
+ * loop idioms over one array row, recognized on the ast before the generic while codegen:
+ *
+ *     while(i < n) { A[..][i] = e;                 i = i + 1; }   <- fill
+ *     while(i < n) { A[..][i] = B[..][i];          i = i + 1; }   <- copy
+ *     while(i < n) { s = s + A[..][i];             i = i + 1; }   <- reduce, also s - A[..][i]
+ *     while(i < n) { if(A[..][i] > s) s = A[..][i]; i = i + 1; }   <- max, also min
+ *
+ * n, e and the leading indices are loop invariant; the loop is emitted as a pointer walk
+ * unrolled IDIOM_UNROLL times plus a tail, elements are still visited in order
+ *
+ * reductions keep one accumulator per unrolled lane, so the lanes do not wait on each other,
+ * and fold them into s after the unrolled part; wrapping add, max and min are associative
+ */
+
+const int IDIOM_UNROLL = 4;
+
+enum ReduceKind {
+    ReduceNone, ReduceAdd, ReduceSub, ReduceMax, ReduceMin
+};
+
+struct IdiomLoop {
+    AstDef *i;
+    AstExp *n;
+    AstStmt *stmt;
+    unordered_set<AstDef*> written;
+
+    // filled by the matcher
+    AstExpLVal *row; // walked by the first pointer
+    AstExpLVal *src_row; // walked by the second pointer, or null
+    AstExp *fill; // evaluated once before the loop, or null
+    ReduceKind reduce;
+    AstDef *acc; // reduced scalar, or null
+
+    // filled by the driver, one accumulator per lane, lane 0 is acc itself
+    vector<LVal> lanes;
+};
+
+static AstDef *scalar_var_or_null(AstExp *exp) {
+    if(!istype(exp, AstExpLVal))
+        return nullptr;
+    auto lval = (AstExpLVal*)exp;
+    if(!lval->idxinfo->val.empty() || lval->def->idxinfo->dims()>0 || !lval->get_const().iserror)
+        return nullptr;
+    return lval->def;
+}
+
+static bool is_invariant(AstExp *exp, const unordered_set<AstDef*> &written) {
+    // no calls, no array reads, no scalar written in the loop
+    if(istype(exp, AstExpLiteral))
+        return true;
+    if(istype(exp, AstExpLVal)) {
+        auto lval = (AstExpLVal*)exp;
+        if(!lval->get_const().iserror)
+            return true;
+        return scalar_var_or_null(lval) && written.find(lval->def)==written.end();
+    }
+    if(istype(exp, AstExpOpUnary))
+        return is_invariant(((AstExpOpUnary*)exp)->operand, written);
+    if(istype(exp, AstExpOpBinary))
+        return is_invariant(((AstExpOpBinary*)exp)->operand1, written) &&
+            is_invariant(((AstExpOpBinary*)exp)->operand2, written);
+    return false;
+}
+
+static bool is_row_access(AstExp *exp, const IdiomLoop &loop) {
+    // A[..][i] with every dim indexed, only the last by i
+    if(!istype(exp, AstExpLVal))
+        return false;
+    auto lval = (AstExpLVal*)exp;
+    int dims = lval->idxinfo->dims();
+    if(dims==0 || dims!=lval->def->idxinfo->dims() || !lval->get_const().iserror)
+        return false;
+
+    for(int d=0; d<dims-1; d++)
+        if(!is_invariant(lval->idxinfo->val[d], loop.written))
+            return false;
+    return scalar_var_or_null(lval->idxinfo->val[dims-1])==loop.i;
+}
+
+static LVal gen_row_ptr(AstExpLVal *lval, RVal i, IrFuncDef *func) {
+    // &A[..][0] + i*4
+    auto rowidx = new AstMaybeIdx();
+    for(int d=0; d<lval->idxinfo->dims()-1; d++)
+        rowidx->push_val(lval->idxinfo->val[d]);
+    rowidx->push_val(new AstExpLiteral(0));
+
+    RVal rowoff = lval->def->initval.get_offset_bytes(rowidx, false)->gen_rval(func);
+    LVal ptr = func->gen_scalar_tempvar();
+    LVal off = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpBinary(func, off, i, OpMul, RVal::asConstExp(4)));
+    if(rowoff.type==RVal::ConstExp && rowoff.val.constexp==0) {
+        func->push_stmt(new IrOpBinary(func, ptr, lval->def, OpPlus, off), "idiom - ptr");
+    } else {
+        func->push_stmt(new IrOpBinary(func, ptr, lval->def, OpPlus, rowoff), "idiom - row");
+        func->push_stmt(new IrOpBinary(func, ptr, ptr, OpPlus, off), "idiom - ptr");
+    }
+    return ptr;
+}
+
+/// FILL
+
+static bool match_fill(IdiomLoop &loop) {
+    if(!istype(loop.stmt, AstStmtAssignment))
+        return false;
+    auto stmt = (AstStmtAssignment*)loop.stmt;
+    if(!is_row_access(stmt->lval, loop) || !is_invariant(stmt->rval, loop.written))
+        return false;
+    loop.row = stmt->lval;
+    loop.fill = stmt->rval;
+    return true;
+}
+
+static void emit_fill_elem(IdiomLoop &loop, IrFuncDef *func, const vector<LVal> &ptrs, RVal val, int offset, int lane) {
+    func->push_stmt(new IrArraySet(func, ptrs[0], offset, val));
+}
+
+/// COPY
+
+static bool match_copy(IdiomLoop &loop) {
+    if(!istype(loop.stmt, AstStmtAssignment))
+        return false;
+    auto stmt = (AstStmtAssignment*)loop.stmt;
+    if(!is_row_access(stmt->lval, loop) || !is_row_access(stmt->rval, loop))
+        return false;
+    loop.row = stmt->lval;
+    loop.src_row = (AstExpLVal*)stmt->rval;
+    return true;
+}
+
+static void emit_copy_elem(IdiomLoop &loop, IrFuncDef *func, const vector<LVal> &ptrs, RVal val, int offset, int lane) {
+    // load and store each element in turn, so overlapping rows behave as the original loop
+    LVal x = func->gen_scalar_tempvar();
+    func->push_stmt(new IrArrayGet(func, x, ptrs[1], offset));
+    func->push_stmt(new IrArraySet(func, ptrs[0], offset, x));
+}
+
+/// REDUCE
+
+static bool match_reduce(IdiomLoop &loop) {
+    // s = s + A[i], s = A[i] + s or s = s - A[i]
+    if(!istype(loop.stmt, AstStmtAssignment))
+        return false;
+    auto stmt = (AstStmtAssignment*)loop.stmt;
+    auto s = scalar_var_or_null(stmt->lval);
+    if(!s || s==loop.i || !istype(stmt->rval, AstExpOpBinary))
+        return false;
+    auto add = (AstExpOpBinary*)stmt->rval;
+    if(add->op!=OpPlus && add->op!=OpMinus)
+        return false;
+
+    loop.written.insert(s);
+    if(scalar_var_or_null(add->operand1)==s && is_row_access(add->operand2, loop))
+        loop.row = (AstExpLVal*)add->operand2;
+    else if(add->op==OpPlus && scalar_var_or_null(add->operand2)==s && is_row_access(add->operand1, loop))
+        loop.row = (AstExpLVal*)add->operand1;
+    else {
+        loop.written.erase(s);
+        return false;
+    }
+
+    loop.reduce = add->op==OpPlus ? ReduceAdd : ReduceSub;
+    loop.acc = s;
+    return true;
+}
+
+static void emit_reduce_elem(IdiomLoop &loop, IrFuncDef *func, const vector<LVal> &ptrs, RVal val, int offset, int lane) {
+    LVal x = func->gen_scalar_tempvar();
+    func->push_stmt(new IrArrayGet(func, x, ptrs[0], offset));
+    func->push_stmt(new IrOpBinary(func, loop.lanes[lane], loop.lanes[lane], loop.reduce==ReduceAdd ? OpPlus : OpMinus, x));
+}
+
+/// MAX, MIN
+
+static bool same_row_access(AstExp *a, AstExp *b) {
+    // both passed `is_row_access`, so the last index is i
+    auto la = (AstExpLVal*)a, lb = (AstExpLVal*)b;
+    if(la->def!=lb->def)
+        return false;
+    for(int d=0; d<la->idxinfo->dims()-1; d++)
+        if(la->idxinfo->val[d]->asthash()!=lb->idxinfo->val[d]->asthash())
+            return false;
+    return true;
+}
+
+static bool match_max_min(IdiomLoop &loop) {
+    // if(A[i] > s) s = A[i], or < for min, >= and <= are the same
+    if(!istype(loop.stmt, AstStmtIfOnly) || !istype(((AstStmtIfOnly*)loop.stmt)->cond, AstExpOpBinary))
+        return false;
+    auto cond = (AstExpOpBinary*)((AstStmtIfOnly*)loop.stmt)->cond;
+    Ast *body = ((AstStmtIfOnly*)loop.stmt)->body;
+    if(istype(body, AstStmtBlock) && ((AstStmtBlock*)body)->block->body.size()==1)
+        body = ((AstStmtBlock*)body)->block->body[0];
+    if(!istype(body, AstStmtAssignment))
+        return false;
+    auto stmt = (AstStmtAssignment*)body;
+    auto s = scalar_var_or_null(stmt->lval);
+    if(!s || s==loop.i)
+        return false;
+
+    // normalized to `A[i] op s`
+    AstExp *elem = cond->operand1;
+    BinaryOpKinds op = cond->op;
+    if(scalar_var_or_null(cond->operand1)==s) {
+        elem = cond->operand2;
+        op = op==OpLess ? OpGreater : op==OpGreater ? OpLess : op==OpLeq ? OpGeq : op==OpGeq ? OpLeq : op;
+    } else if(scalar_var_or_null(cond->operand2)!=s) {
+        return false;
+    }
+
+    loop.written.insert(s);
+    if(!is_row_access(elem, loop) || !is_row_access(stmt->rval, loop) || !same_row_access(elem, stmt->rval)) {
+        loop.written.erase(s);
+        return false;
+    }
+    if(op==OpGreater || op==OpGeq)
+        loop.reduce = ReduceMax;
+    else if(op==OpLess || op==OpLeq)
+        loop.reduce = ReduceMin;
+    else {
+        loop.written.erase(s);
+        return false;
+    }
+
+    loop.row = (AstExpLVal*)elem;
+    loop.acc = s;
+    return true;
+}
+
+static void emit_max_min_elem(IdiomLoop &loop, IrFuncDef *func, const vector<LVal> &ptrs, RVal val, int offset, int lane) {
+    LVal x = func->gen_scalar_tempvar();
+    int lskip = func->gen_label();
+    func->push_stmt(new IrArrayGet(func, x, ptrs[0], offset));
+    func->push_stmt(new IrCondGoto(func, x, loop.reduce==ReduceMax ? RelLeq : RelGeq, loop.lanes[lane], lskip));
+    func->push_stmt(new IrMov(func, loop.lanes[lane], x));
+    func->push_stmt(new IrLabel(func, lskip));
+}
+
+/// DRIVER
+
+struct Idiom {
+    const char *name;
+    bool (*match)(IdiomLoop &loop);
+    void (*emit_elem)(IdiomLoop &loop, IrFuncDef *func, const vector<LVal> &ptrs, RVal val, int offset, int lane);
+};
+
+const Idiom IDIOMS[] = {
+    {"fill", match_fill, emit_fill_elem},
+    {"copy", match_copy, emit_copy_elem},
+    {"reduce", match_reduce, emit_reduce_elem},
+    {"max/min", match_max_min, emit_max_min_elem},
+};
+
+static bool match_loop_shape(AstStmtWhile *loop_stmt, IdiomLoop &loop) {
+    // while(i < n) { stmt; i = i + 1; }
+    if(!istype(loop_stmt->cond, AstExpOpBinary) || !istype(loop_stmt->body, AstStmtBlock))
+        return false;
+    auto cond = (AstExpOpBinary*)loop_stmt->cond;
+    auto &body = ((AstStmtBlock*)loop_stmt->body)->block->body;
+    if(cond->op!=OpLess || body.size()!=2 || !istype(body[0], AstStmt) || !istype(body[1], AstStmtAssignment))
+        return false;
+
+    loop.i = scalar_var_or_null(cond->operand1);
+    loop.n = cond->operand2;
+    loop.stmt = (AstStmt*)body[0];
+    loop.row = loop.src_row = nullptr;
+    loop.fill = nullptr;
+    loop.reduce = ReduceNone;
+    loop.acc = nullptr;
+    if(!loop.i)
+        return false;
+
+    auto step = (AstStmtAssignment*)body[1];
+    if(scalar_var_or_null(step->lval)!=loop.i || !istype(step->rval, AstExpOpBinary))
+        return false;
+    auto inc = (AstExpOpBinary*)step->rval;
+    if(inc->op!=OpPlus || scalar_var_or_null(inc->operand1)!=loop.i || inc->operand2->get_const().iserror || inc->operand2->get_const().val!=1)
+        return false;
+
+    loop.written.insert(loop.i);
+    return true;
+}
+
+bool AstStmtWhile::gen_ir_idiom(IrFuncDef *func) {
+    IdiomLoop loop;
+    if(!match_loop_shape(this, loop))
+        return false;
+
+    const Idiom *idiom = nullptr;
+    for(const auto &candidate: IDIOMS)
+        if(candidate.match(loop)) {
+            idiom = &candidate;
+            break;
+        }
+    if(!idiom || !is_invariant(loop.n, loop.written))
+        return false;
+
+    /*
+     *     if !(i < n) goto ldone
+     *     p = &A[..][i], end = &A[..][n]
+     *     if p >= end - 4*(U-1) goto ltail
+     * lunroll:
+     *     U elements, p += 4*U
+     *     if p < end - 4*(U-1) goto lunroll
+     * ltail:
+     *     if p >= end goto lfin
+     * lloop:
+     *     1 element, p += 4
+     *     if p < end goto lloop
+     * lfin:
+     *     i = n
+     * ldone:
+     */
+    ldone = func->gen_label();
+    cond->gen_cond(func, -1, ldone);
+
+    RVal val = loop.fill ? loop.fill->gen_rval(func) : RVal::asConstExp(0);
+    vector<LVal> ptrs;
+    ptrs.push_back(gen_row_ptr(loop.row, loop.i, func));
+    if(loop.src_row)
+        ptrs.push_back(gen_row_ptr(loop.src_row, loop.i, func));
+
+    // end = p + (n - i) * 4
+    RVal n = loop.n->gen_rval(func);
+    LVal end = func->gen_scalar_tempvar();
+    LVal endunroll = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpBinary(func, end, n, OpMinus, loop.i));
+    func->push_stmt(new IrOpBinary(func, end, end, OpMul, RVal::asConstExp(4)));
+    func->push_stmt(new IrOpBinary(func, end, ptrs[0], OpPlus, end), string("idiom ") + idiom->name + " - end");
+    func->push_stmt(new IrOpBinary(func, endunroll, end, OpMinus, RVal::asConstExp(4*(IDIOM_UNROLL-1))));
+
+    auto advance = [&](int bytes) {
+        for(auto ptr: ptrs)
+            func->push_stmt(new IrOpBinary(func, ptr, ptr, OpPlus, RVal::asConstExp(bytes)));
+    };
+
+    int lunroll = func->gen_label();
+    int ltail = func->gen_label();
+    int lloop = func->gen_label();
+    int lfin = func->gen_label();
+
+    // lanes start as the identity: 0 for sums, s itself for max and min
+    if(loop.reduce!=ReduceNone) {
+        loop.lanes.push_back(loop.acc);
+        for(int u=1; u<IDIOM_UNROLL; u++) {
+            LVal lane = func->gen_scalar_tempvar();
+            bool sum = loop.reduce==ReduceAdd || loop.reduce==ReduceSub;
+            func->push_stmt(new IrMov(func, lane, sum ? RVal::asConstExp(0) : RVal(loop.acc)), "idiom - lane");
+            loop.lanes.push_back(lane);
+        }
+    }
+
+    func->push_stmt(new IrCondGoto(func, ptrs[0], RelGeq, endunroll, ltail));
+    func->push_stmt(new IrLabel(func, lunroll), "idiom - lunroll");
+    for(int u=0; u<IDIOM_UNROLL; u++)
+        idiom->emit_elem(loop, func, ptrs, val, u*4, u);
+    advance(4*IDIOM_UNROLL);
+    func->push_stmt(new IrCondGoto(func, ptrs[0], RelLess, endunroll, lunroll));
+
+    func->push_stmt(new IrLabel(func, ltail), "idiom - ltail");
+    for(int u=1; u<(int)loop.lanes.size(); u++) {
+        if(loop.reduce==ReduceAdd || loop.reduce==ReduceSub) {
+            func->push_stmt(new IrOpBinary(func, loop.acc, loop.acc, OpPlus, loop.lanes[u]), "idiom - fold lane");
+        } else {
+            int lskip = func->gen_label();
+            func->push_stmt(new IrCondGoto(func, loop.lanes[u], loop.reduce==ReduceMax ? RelLeq : RelGeq, loop.acc, lskip), "idiom - fold lane");
+            func->push_stmt(new IrMov(func, loop.acc, loop.lanes[u]));
+            func->push_stmt(new IrLabel(func, lskip));
+        }
+    }
+    func->push_stmt(new IrCondGoto(func, ptrs[0], RelGeq, end, lfin));
+    func->push_stmt(new IrLabel(func, lloop), "idiom - lloop");
+    idiom->emit_elem(loop, func, ptrs, val, 0, 0);
+    advance(4);
+    func->push_stmt(new IrCondGoto(func, ptrs[0], RelLess, end, lloop));
+
+    func->push_stmt(new IrLabel(func, lfin), "idiom - lfin");
+    func->push_stmt(new IrMov(func, loop.i, n));
+    func->push_stmt(new IrLabel(func, ldone), "idiom - ldone");
+    return true;
+}
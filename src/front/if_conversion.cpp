@@ -0,0 +1,134 @@
+#include "../main/common.hpp"
+#include "ast.hpp"
+
+/*
+ * small if/else assigning one scalar from cheap exps become a branchless select:
+ *
+ *     if(a < b) v = e1; else v = e2;           if(a < b) v = e1;      <- e2 is v itself
+ *
+ *     c = a < b
+ *     m = -c                                   <- all ones or zero
+ *     v = e2 ^ ((e1 ^ e2) & m)
+ *
+ * with `if(x < 0) x = -x` as abs, `v = (x ^ m) - m`, and 0/1 arms as the compare itself;
+ * both arms are evaluated, so they only read scalars and cannot trap
+ */
+
+bool IF_CONVERSION = true; // the masks need bitwise ops, only in riscv output
+
+const int BRANCH_MISS_COST = 4; // expected, half the time a refill of about 8 insts
+const int SELECT_COST = 4; // neg, xor, and, xor
+
+static int cheap_cost(AstExp *exp) {
+    // insts to evaluate exp, or -1 if it may trap, call or read memory
+    if(!exp->get_const().iserror) {
+        int val = exp->get_const().val;
+        return val==0 ? 0 : imm_overflows(val) ? 2 : 1; // x0, li, lui + addi
+    }
+    if(istype(exp, AstExpLVal)) {
+        auto lval = (AstExpLVal*)exp;
+        if(lval->promoted>=0)
+            return 0;
+        if(!lval->idxinfo->val.empty() || lval->def->idxinfo->dims()>0)
+            return -1;
+        return lval->def->pos==DefGlobal ? 2 : 0;
+    }
+    if(istype(exp, AstExpOpUnary)) {
+        int cost = cheap_cost(((AstExpOpUnary*)exp)->operand);
+        return cost<0 ? -1 : cost+1;
+    }
+    if(istype(exp, AstExpOpBinary)) {
+        auto binary = (AstExpOpBinary*)exp;
+        if(binary->op==OpDiv || binary->op==OpMod || binary->op==OpAnd || binary->op==OpOr)
+            return -1;
+        int cost1 = cheap_cost(binary->operand1), cost2 = cheap_cost(binary->operand2);
+        return cost1<0 || cost2<0 ? -1 : cost1+cost2+1;
+    }
+    return -1;
+}
+
+static AstStmtAssignment *single_assignment_or_null(AstStmt *stmt) {
+    if(istype(stmt, AstStmtBlock) && ((AstStmtBlock*)stmt)->block->body.size()==1)
+        return single_assignment_or_null((AstStmt*)((AstStmtBlock*)stmt)->block->body[0]);
+    if(!istype(stmt, AstStmtAssignment))
+        return nullptr;
+
+    // scalars, or elements kept in a tempvar
+    auto lval = ((AstStmtAssignment*)stmt)->lval;
+    if(lval->promoted<0 && (!lval->idxinfo->val.empty() || lval->def->idxinfo->dims()>0))
+        return nullptr;
+    return (AstStmtAssignment*)stmt;
+}
+
+static bool is_const(AstExp *exp, int val) {
+    return !exp->get_const().iserror && exp->get_const().val==val;
+}
+
+static bool gen_select(IrFuncDef *func, AstExp *cond, AstStmtAssignment *on_true, AstStmtAssignment *on_false_or_null) {
+    if(!IF_CONVERSION || !istype(cond, AstExpOpBinary) || cvt_to_rel(((AstExpOpBinary*)cond)->op)==NotARel)
+        return false;
+    auto compare = (AstExpOpBinary*)cond;
+    auto dest = on_true->lval;
+    if(on_false_or_null && (dest->promoted!=on_false_or_null->lval->promoted || dest->def!=on_false_or_null->lval->def))
+        return false;
+    AstExp *tval = on_true->rval;
+    AstExp *fval = on_false_or_null ? on_false_or_null->rval : dest;
+
+    int cost_cond = cheap_cost(compare), cost_t = cheap_cost(tval), cost_f = cheap_cost(fval);
+    if(cost_cond<0 || cost_t<0 || cost_f<0)
+        return false;
+
+    // x = x < 0 ? -x : x, also x <= 0 and 0 > x
+    AstExp *abs_of = nullptr;
+    if(istype(tval, AstExpOpUnary) && ((AstExpOpUnary*)tval)->op==OpNeg) {
+        auto x = ((AstExpOpUnary*)tval)->operand;
+        bool x_lt_0 = (compare->op==OpLess || compare->op==OpLeq) && is_const(compare->operand2, 0) && x->asthash()==compare->operand1->asthash();
+        bool zero_gt_x = (compare->op==OpGreater || compare->op==OpGeq) && is_const(compare->operand1, 0) && x->asthash()==compare->operand2->asthash();
+        if((x_lt_0 || zero_gt_x) && x->asthash()==fval->asthash())
+            abs_of = fval;
+    }
+    bool zero_one = is_const(tval, 1) && is_const(fval, 0);
+
+    // branchy: the compare and branch, a miss now and then, one of the arms, the jump over the else arm
+    int branchless = abs_of ? cost_cond+3 : zero_one ? cost_cond : cost_cond+cost_t+cost_f+SELECT_COST;
+    int branchy = cost_cond + BRANCH_MISS_COST + (cost_t + (on_false_or_null ? cost_f+1 : 0)) / 2;
+    if(branchless>branchy)
+        return false;
+
+    RVal a = compare->operand1->gen_rval(func);
+    RVal b = compare->operand2->gen_rval(func);
+    LVal c = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpBinary(func, c, a, compare->op, b), "select - cond");
+    if(zero_one) {
+        dest->gen_store(func, c);
+        return true;
+    }
+
+    LVal m = func->gen_scalar_tempvar();
+    LVal d = func->gen_scalar_tempvar();
+    func->push_stmt(new IrOpUnary(func, m, OpNeg, c), "select - mask");
+    if(abs_of) {
+        RVal x = abs_of->gen_rval(func);
+        func->push_stmt(new IrOpBinary(func, d, x, OpBitXor, m), "select - abs");
+        func->push_stmt(new IrOpBinary(func, d, d, OpMinus, m));
+    } else {
+        RVal t = tval->gen_rval(func);
+        RVal f = fval->gen_rval(func);
+        func->push_stmt(new IrOpBinary(func, d, t, OpBitXor, f));
+        func->push_stmt(new IrOpBinary(func, d, d, OpBitAnd, m));
+        func->push_stmt(new IrOpBinary(func, d, f, OpBitXor, d));
+    }
+    dest->gen_store(func, d);
+    return true;
+}
+
+bool AstStmtIfOnly::gen_ir_select(IrFuncDef *func) {
+    auto on_true = single_assignment_or_null(body);
+    return on_true && gen_select(func, cond, on_true, nullptr);
+}
+
+bool AstStmtIfElse::gen_ir_select(IrFuncDef *func) {
+    auto on_true = single_assignment_or_null(body_true);
+    auto on_false = single_assignment_or_null(body_false);
+    return on_true && on_false && gen_select(func, cond, on_true, on_false);
+}
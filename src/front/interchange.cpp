@@ -0,0 +1,350 @@
+#include <map>
+#include <unordered_set>
+using std::map;
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ast.hpp"
+
+/*
+ * loop interchange, done on the ast where subscripts are still explicit:
+ *
+ *     while(x < N) { y = Y0; while(y < M) { S; y = y + 1; } x = x + 1; }
+ *
+ * is emitted with the y loop outside, if the array accesses in S have more non-unit strides
+ * along y than along x, e.g. `C[i][j] += A[i][k] * B[k][j]` in a j, k nest becomes k, j
+ *
+ * every subscript must be affine in scalars; N, M and Y0 must not change inside the nest;
+ * an array written in S must be accessed with the same subscripts everywhere in S, one of
+ * them pinning x or y, so no two iterations whose order is swapped touch the same element;
+ * scalars written in S must be set before use in each iteration, or be `s = s + e` sums
+ */
+
+typedef map<AstDef*, int> AffineForm; // scalar -> coefficient, nullptr -> constant
+
+static bool affine_form(AstExp *exp, int scale, AffineForm &form) {
+    if(!exp->get_const().iserror) {
+        form[nullptr] += scale * exp->get_const().val;
+        return true;
+    }
+    if(istype(exp, AstExpLVal)) {
+        auto lval = (AstExpLVal*)exp;
+        if(lval->def->idxinfo->dims()>0)
+            return false;
+        form[lval->def] += scale;
+        return true;
+    }
+    if(istype(exp, AstExpOpUnary)) {
+        auto unary = (AstExpOpUnary*)exp;
+        if(unary->op==OpPos)
+            return affine_form(unary->operand, scale, form);
+        if(unary->op==OpNeg)
+            return affine_form(unary->operand, -scale, form);
+        return false;
+    }
+    if(istype(exp, AstExpOpBinary)) {
+        auto binary = (AstExpOpBinary*)exp;
+        if(binary->op==OpPlus)
+            return affine_form(binary->operand1, scale, form) && affine_form(binary->operand2, scale, form);
+        if(binary->op==OpMinus)
+            return affine_form(binary->operand1, scale, form) && affine_form(binary->operand2, -scale, form);
+        if(binary->op==OpMul && !binary->operand1->get_const().iserror)
+            return affine_form(binary->operand2, scale * binary->operand1->get_const().val, form);
+        if(binary->op==OpMul && !binary->operand2->get_const().iserror)
+            return affine_form(binary->operand1, scale * binary->operand2->get_const().val, form);
+    }
+    return false;
+}
+
+static int coeff_of(const AffineForm &form, AstDef *var) {
+    auto it = form.find(var);
+    return it==form.end() ? 0 : it->second;
+}
+
+struct NestAccess {
+    AstExpLVal *lval;
+    bool write;
+    vector<AffineForm> subscripts;
+};
+
+struct NestScan {
+    bool ok;
+    vector<NestAccess> accesses;
+    unordered_set<AstDef*> reads; // scalars
+    unordered_set<AstDef*> writes; // scalars
+    unordered_set<AstStmtWhile*> loops; // loops inside, targets of breaks and continues
+    vector<AstStmtWhile*> jumps;
+
+    NestScan(): ok(true) {}
+
+    void access(AstExpLVal *lval, bool write) {
+        if(lval->idxinfo->val.empty()) {
+            (write ? writes : reads).insert(lval->def);
+            return;
+        }
+        if(lval->dim_left!=0) {
+            ok = false;
+            return;
+        }
+        NestAccess acc = {lval, write, {}};
+        for(auto sub: lval->idxinfo->val) {
+            AffineForm form;
+            if(!affine_form(sub, 1, form))
+                ok = false;
+            acc.subscripts.push_back(form);
+            exp(sub);
+        }
+        accesses.push_back(acc);
+    }
+
+    void exp(AstExp *e) {
+        if(!e->get_const().iserror)
+            return;
+        if(istype(e, AstExpLVal))
+            access((AstExpLVal*)e, false);
+        else if(istype(e, AstExpOpUnary))
+            exp(((AstExpOpUnary*)e)->operand);
+        else if(istype(e, AstExpOpBinary)) {
+            exp(((AstExpOpBinary*)e)->operand1);
+            exp(((AstExpOpBinary*)e)->operand2);
+        } else if(!istype(e, AstExpLiteral))
+            ok = false; // calls
+    }
+
+    void stmt(Ast *s) {
+        if(istype(s, AstStmtAssignment)) {
+            exp(((AstStmtAssignment*)s)->rval);
+            access(((AstStmtAssignment*)s)->lval, true);
+        } else if(istype(s, AstStmtExp)) {
+            exp(((AstStmtExp*)s)->exp);
+        } else if(istype(s, AstStmtBlock)) {
+            for(auto sub: ((AstStmtBlock*)s)->block->body)
+                stmt(sub);
+        } else if(istype(s, AstStmtIfOnly)) {
+            exp(((AstStmtIfOnly*)s)->cond);
+            stmt(((AstStmtIfOnly*)s)->body);
+        } else if(istype(s, AstStmtIfElse)) {
+            exp(((AstStmtIfElse*)s)->cond);
+            stmt(((AstStmtIfElse*)s)->body_true);
+            stmt(((AstStmtIfElse*)s)->body_false);
+        } else if(istype(s, AstStmtWhile)) {
+            loops.insert((AstStmtWhile*)s);
+            exp(((AstStmtWhile*)s)->cond);
+            stmt(((AstStmtWhile*)s)->body);
+        } else if(istype(s, AstStmtBreak)) {
+            jumps.push_back(((AstStmtBreak*)s)->loop);
+        } else if(istype(s, AstStmtContinue)) {
+            jumps.push_back(((AstStmtContinue*)s)->loop);
+        } else if(!istype(s, AstStmtVoid)) {
+            ok = false; // returns, decls
+        }
+    }
+};
+
+static AstDef *scalar_var_or_null(AstExp *exp) {
+    if(!istype(exp, AstExpLVal))
+        return nullptr;
+    auto lval = (AstExpLVal*)exp;
+    if(!lval->idxinfo->val.empty() || lval->def->idxinfo->dims()>0 || !lval->get_const().iserror)
+        return nullptr;
+    return lval->def;
+}
+
+static bool is_increment(Ast *s, AstDef *var) {
+    // var = var + 1
+    if(!istype(s, AstStmtAssignment) || scalar_var_or_null(((AstStmtAssignment*)s)->lval)!=var)
+        return false;
+    auto rval = ((AstStmtAssignment*)s)->rval;
+    if(!istype(rval, AstExpOpBinary) || ((AstExpOpBinary*)rval)->op!=OpPlus)
+        return false;
+    auto inc = ((AstExpOpBinary*)rval)->operand2;
+    return scalar_var_or_null(((AstExpOpBinary*)rval)->operand1)==var && !inc->get_const().iserror && inc->get_const().val==1;
+}
+
+static bool scalars_private(const vector<Ast*> &body, const unordered_set<AstDef*> &writes) {
+    /*
+     * a scalar written in S is private to an iteration if its first mention in S is a plain
+     * top-level assignment, then both orders leave the value of the last iteration (N-1, M-1);
+     * otherwise it must only appear in `s = s + e`, a sum in any order
+     */
+    for(auto var: writes) {
+        bool is_private = false, is_sum = true;
+        bool mentioned = false;
+        for(auto s: body) {
+            NestScan scan;
+            scan.stmt(s);
+            if(scan.reads.find(var)==scan.reads.end() && scan.writes.find(var)==scan.writes.end())
+                continue;
+
+            bool assigns = istype(s, AstStmtAssignment) && scalar_var_or_null(((AstStmtAssignment*)s)->lval)==var;
+            if(!mentioned)
+                is_private = assigns && scan.reads.find(var)==scan.reads.end();
+            mentioned = true;
+
+            bool sum = false;
+            if(assigns && istype(((AstStmtAssignment*)s)->rval, AstExpOpBinary)) {
+                auto add = (AstExpOpBinary*)((AstStmtAssignment*)s)->rval;
+                AstExp *other = scalar_var_or_null(add->operand1)==var ? add->operand2 : add->operand1;
+                NestScan otherscan;
+                otherscan.exp(other);
+                sum = add->op==OpPlus && otherscan.reads.find(var)==otherscan.reads.end() &&
+                    (scalar_var_or_null(add->operand1)==var || scalar_var_or_null(add->operand2)==var);
+            }
+            is_sum = is_sum && sum;
+        }
+        if(!is_private && !is_sum)
+            return false;
+    }
+    return true;
+}
+
+static bool invariant_in(AstExp *exp, const unordered_set<AstDef*> &changed) {
+    NestScan scan;
+    scan.exp(exp);
+    if(!scan.ok || !scan.accesses.empty())
+        return false;
+    for(auto var: scan.reads)
+        if(changed.find(var)!=changed.end())
+            return false;
+    return true;
+}
+
+static int row_elems(AstDef *def, int dim) {
+    // elements between a[..][k] and a[..][k+1] along `dim`
+    int n = 1;
+    for(int d=dim+1; d<def->idxinfo->dims(); d++)
+        n *= def->idxinfo->val[d]->get_const().val;
+    return n;
+}
+
+static int noncontiguous_accesses(const NestScan &scan, AstDef *var) {
+    int count = 0;
+    for(const auto &acc: scan.accesses) {
+        long long stride = 0;
+        for(int d=0; d<(int)acc.subscripts.size(); d++)
+            stride += (long long)coeff_of(acc.subscripts[d], var) * row_elems(acc.lval->def, d);
+        if(stride>1 || stride<-1)
+            count++;
+    }
+    return count;
+}
+
+static bool swap_is_legal(const NestScan &scan, AstDef *x, AstDef *y, const unordered_set<AstDef*> &changed) {
+    bool writes_array = false, touches_param_array = false;
+    for(const auto &acc: scan.accesses) {
+        writes_array = writes_array || acc.write;
+        touches_param_array = touches_param_array || acc.lval->def->pos==DefArg;
+    }
+    if(writes_array && touches_param_array)
+        return false; // params may alias each other and globals
+
+    for(const auto &acc: scan.accesses) {
+        if(!acc.write)
+            continue;
+
+        // same subscripts at every access of the array
+        for(const auto &other: scan.accesses)
+            if(other.lval->def==acc.lval->def && other.subscripts!=acc.subscripts)
+                return false;
+
+        // some subscript is `a*x + invariant` or `a*y + invariant`
+        bool pinned = false;
+        for(const auto &form: acc.subscripts) {
+            bool has_x = coeff_of(form, x)!=0, has_y = coeff_of(form, y)!=0;
+            bool rest_invariant = true;
+            for(auto term: form)
+                if(term.first && term.first!=x && term.first!=y && term.second!=0 && changed.find(term.first)!=changed.end())
+                    rest_invariant = false;
+            if(has_x!=has_y && rest_invariant)
+                pinned = true;
+        }
+        if(!pinned)
+            return false;
+    }
+    return true;
+}
+
+bool AstStmtWhile::gen_ir_interchanged(IrFuncDef *func) {
+    // while(x < N) { y = Y0; while(y < M) { S; y = y + 1; } x = x + 1; }
+    if(!istype(cond, AstExpOpBinary) || ((AstExpOpBinary*)cond)->op!=OpLess || !istype(body, AstStmtBlock))
+        return false;
+    auto outer_cond = (AstExpOpBinary*)cond;
+    auto &outer_body = ((AstStmtBlock*)body)->block->body;
+    AstDef *x = scalar_var_or_null(outer_cond->operand1);
+    if(!x || outer_body.size()!=3 || !istype(outer_body[0], AstStmtAssignment) || !istype(outer_body[1], AstStmtWhile) || !is_increment(outer_body[2], x))
+        return false;
+
+    auto init = (AstStmtAssignment*)outer_body[0];
+    auto inner = (AstStmtWhile*)outer_body[1];
+    AstDef *y = scalar_var_or_null(init->lval);
+    if(!y || y==x || !istype(inner->cond, AstExpOpBinary) || !istype(inner->body, AstStmtBlock))
+        return false;
+    auto inner_cond = (AstExpOpBinary*)inner->cond;
+    auto &inner_body = ((AstStmtBlock*)inner->body)->block->body;
+    if(inner_cond->op!=OpLess || scalar_var_or_null(inner_cond->operand1)!=y || inner_body.empty() || !is_increment(inner_body.back(), y))
+        return false;
+
+    vector<Ast*> s_body(inner_body.begin(), inner_body.end()-1);
+    NestScan scan;
+    for(auto s: s_body)
+        scan.stmt(s);
+    if(!scan.ok)
+        return false;
+    if(scan.writes.find(x)!=scan.writes.end() || scan.writes.find(y)!=scan.writes.end())
+        return false; // S moves the loop vars itself
+    for(auto target: scan.jumps)
+        if(scan.loops.find(target)==scan.loops.end())
+            return false;
+
+    unordered_set<AstDef*> changed = scan.writes;
+    changed.insert(x);
+    changed.insert(y);
+    if(!invariant_in(outer_cond->operand2, changed) || !invariant_in(inner_cond->operand2, changed) || !invariant_in(init->rval, changed))
+        return false;
+
+    if(noncontiguous_accesses(scan, y)<=noncontiguous_accesses(scan, x))
+        return false;
+    if(!swap_is_legal(scan, x, y, changed) || !scalars_private(s_body, scan.writes))
+        return false;
+
+    /*
+     *     if !(x < N) goto ldone
+     *     x0 = x
+     *     y = Y0
+     *     if !(y < M) goto lfin
+     * lyloop:
+     *     x = x0
+     *     while(x < N) { S; x = x + 1; }   <- generated as any while, so its elements get promoted
+     *     y = y + 1
+     *     if y < M goto lyloop
+     * lfin:
+     *     x = N
+     * ldone:
+     */
+    int lyloop = func->gen_label();
+    int lfin = func->gen_label();
+    ldone = func->gen_label();
+
+    cond->gen_cond(func, -1, ldone);
+    LVal x0 = func->gen_scalar_tempvar();
+    func->push_stmt(new IrMov(func, x0, x), "interchange - x0");
+    init->gen_ir(func);
+    inner->cond->gen_cond(func, -1, lfin);
+
+    auto swapped_body = new AstBlock();
+    for(auto s: s_body)
+        swapped_body->push_val(s);
+    swapped_body->push_val(outer_body[2]);
+    auto swapped = new AstStmtWhile(cond, new AstStmtBlock(swapped_body));
+
+    func->push_stmt(new IrLabel(func, lyloop), "interchange - lyloop");
+    func->push_stmt(new IrMov(func, x, x0));
+    swapped->gen_ir(func);
+    ((AstStmt*)inner_body.back())->gen_ir(func);
+    inner->cond->gen_cond(func, lyloop, -1);
+
+    func->push_stmt(new IrLabel(func, lfin), "interchange - lfin");
+    func->push_stmt(new IrMov(func, x, outer_cond->operand2->gen_rval(func)));
+    func->push_stmt(new IrLabel(func, ldone), "interchange - ldone");
+    return true;
+}
@@ -0,0 +1,243 @@
+#include <map>
+#include <unordered_set>
+using std::map;
+using std::unordered_set;
+
+#include "../main/common.hpp"
+#include "ast.hpp"
+
+/*
+ * array elements at a loop invariant address, e.g. `c[i][j]` in a k loop, are kept in a tempvar:
+ * loaded once after the loop guard, stored once at the loop exit if written
+ *
+ * the loop must have no calls, returns or jumps out of it; every access to the array in the loop
+ * uses the same invariant subscripts; array params may alias each other and globals, so no other
+ * array that may share memory with it is accessed in the loop
+ */
+
+const int PROMOTE_MAX = 4; // elements per loop, each takes a reg through the loop
+
+struct LoopScan {
+    bool ok;
+    vector<pair<AstExpLVal*, bool>> elems; // array element accesses, written
+    unordered_set<AstDef*> written; // scalars, and arrays declared in the loop
+    unordered_set<AstStmtWhile*> loops; // loops inside, targets of breaks and continues
+    vector<AstStmtWhile*> jumps;
+    bool definite; // only accesses made on every pass through the body
+
+    LoopScan(bool definite = false): ok(true), definite(definite) {}
+
+    void access(AstExpLVal *lval, bool write) {
+        if(lval->promoted>=0) // already a tempvar of an outer loop
+            return;
+        if(lval->idxinfo->val.empty()) {
+            if(write)
+                written.insert(lval->def);
+            return;
+        }
+        if(lval->dim_left!=0) {
+            ok = false;
+            return;
+        }
+        elems.push_back(make_pair(lval, write));
+        for(auto sub: lval->idxinfo->val)
+            exp(sub);
+    }
+
+    void exp(AstExp *e) {
+        if(!e->get_const().iserror)
+            return;
+        if(istype(e, AstExpLVal))
+            access((AstExpLVal*)e, false);
+        else if(istype(e, AstExpOpUnary))
+            exp(((AstExpOpUnary*)e)->operand);
+        else if(istype(e, AstExpOpBinary)) {
+            auto op = ((AstExpOpBinary*)e)->op;
+            exp(((AstExpOpBinary*)e)->operand1);
+            if(!definite || (op!=OpAnd && op!=OpOr))
+                exp(((AstExpOpBinary*)e)->operand2);
+        } else if(!istype(e, AstExpLiteral))
+            ok = false; // calls
+    }
+
+    void initval(AstInitVal *init) {
+        if(!init)
+            return;
+        if(!init->is_many)
+            exp(init->val.single);
+        else
+            for(auto sub: *init->val.many)
+                initval(sub);
+    }
+
+    void stmt(Ast *s) {
+        if(definite && !istype(s, AstDecl) && !istype(s, AstStmtAssignment) && !istype(s, AstStmtExp) && !istype(s, AstStmtBlock)) {
+            ok = false; // may branch, nothing after it is definite
+            return;
+        }
+        if(!ok) {
+            return;
+        } else if(istype(s, AstDecl)) {
+            for(auto def: ((AstDecl*)s)->defs->val) {
+                written.insert(def);
+                initval(def->ast_initval_or_null);
+            }
+        } else if(istype(s, AstStmtAssignment)) {
+            exp(((AstStmtAssignment*)s)->rval);
+            access(((AstStmtAssignment*)s)->lval, true);
+        } else if(istype(s, AstStmtExp)) {
+            exp(((AstStmtExp*)s)->exp);
+        } else if(istype(s, AstStmtBlock)) {
+            for(auto sub: ((AstStmtBlock*)s)->block->body)
+                stmt(sub);
+        } else if(istype(s, AstStmtIfOnly)) {
+            exp(((AstStmtIfOnly*)s)->cond);
+            stmt(((AstStmtIfOnly*)s)->body);
+        } else if(istype(s, AstStmtIfElse)) {
+            exp(((AstStmtIfElse*)s)->cond);
+            stmt(((AstStmtIfElse*)s)->body_true);
+            stmt(((AstStmtIfElse*)s)->body_false);
+        } else if(istype(s, AstStmtWhile)) {
+            loops.insert((AstStmtWhile*)s);
+            exp(((AstStmtWhile*)s)->cond);
+            stmt(((AstStmtWhile*)s)->body);
+        } else if(istype(s, AstStmtBreak)) {
+            jumps.push_back(((AstStmtBreak*)s)->loop);
+        } else if(istype(s, AstStmtContinue)) {
+            jumps.push_back(((AstStmtContinue*)s)->loop);
+        } else if(!istype(s, AstStmtVoid)) {
+            ok = false; // returns
+        }
+    }
+};
+
+static bool is_invariant(AstExp *exp, const unordered_set<AstDef*> &written) {
+    // no calls, no array reads, no scalar written in the loop
+    if(!exp->get_const().iserror || istype(exp, AstExpLiteral))
+        return true;
+    if(istype(exp, AstExpLVal)) {
+        auto lval = (AstExpLVal*)exp;
+        return lval->idxinfo->val.empty() && lval->def->idxinfo->dims()==0 && written.find(lval->def)==written.end();
+    }
+    if(istype(exp, AstExpOpUnary))
+        return is_invariant(((AstExpOpUnary*)exp)->operand, written);
+    if(istype(exp, AstExpOpBinary))
+        return is_invariant(((AstExpOpBinary*)exp)->operand1, written) &&
+            is_invariant(((AstExpOpBinary*)exp)->operand2, written);
+    return false;
+}
+
+static bool same_exp(AstExp *a, AstExp *b) {
+    if(!a->get_const().iserror || !b->get_const().iserror)
+        return !a->get_const().iserror && !b->get_const().iserror && a->get_const().val==b->get_const().val;
+    if(istype(a, AstExpLVal) && istype(b, AstExpLVal))
+        return ((AstExpLVal*)a)->def==((AstExpLVal*)b)->def; // both invariant scalars
+    if(istype(a, AstExpOpUnary) && istype(b, AstExpOpUnary))
+        return ((AstExpOpUnary*)a)->op==((AstExpOpUnary*)b)->op &&
+            same_exp(((AstExpOpUnary*)a)->operand, ((AstExpOpUnary*)b)->operand);
+    if(istype(a, AstExpOpBinary) && istype(b, AstExpOpBinary))
+        return ((AstExpOpBinary*)a)->op==((AstExpOpBinary*)b)->op &&
+            same_exp(((AstExpOpBinary*)a)->operand1, ((AstExpOpBinary*)b)->operand1) &&
+            same_exp(((AstExpOpBinary*)a)->operand2, ((AstExpOpBinary*)b)->operand2);
+    return false;
+}
+
+static bool may_alias(AstDef *a, AstDef *b) {
+    // params point into arrays of callers or globals, never into our own locals
+    if(a==b)
+        return true;
+    return (a->pos==DefArg && b->pos!=DefLocal) || (b->pos==DefArg && a->pos!=DefLocal);
+}
+
+bool AstStmtWhile::gen_ir_promoted(IrFuncDef *func) {
+    LoopScan scan, condscan, definitescan(true);
+    scan.stmt(body);
+    condscan.exp(cond);
+    definitescan.stmt(body);
+    if(!scan.ok || !condscan.ok)
+        return false;
+    for(auto target: scan.jumps)
+        if(target!=this && scan.loops.find(target)==scan.loops.end())
+            return false;
+
+    // candidates, in order of first access
+    vector<AstDef*> order;
+    map<AstDef*, vector<AstExpLVal*>> nodes;
+    map<AstDef*, bool> dirty;
+    for(const auto &elempair: scan.elems) {
+        auto def = elempair.first->def;
+        if(nodes.find(def)==nodes.end())
+            order.push_back(def);
+        nodes[def].push_back(elempair.first);
+        dirty[def] = dirty[def] || elempair.second;
+    }
+
+    vector<AstDef*> promoted_defs;
+    for(auto def: order) {
+        auto first = nodes[def][0];
+        if(scan.written.find(def)!=scan.written.end() || (int)promoted_defs.size()>=PROMOTE_MAX)
+            continue;
+
+        bool ok = true;
+        for(auto sub: first->idxinfo->val)
+            ok = ok && is_invariant(sub, scan.written);
+        for(auto node: nodes[def])
+            for(int d=0; ok && d<node->idxinfo->dims(); d++)
+                ok = same_exp(node->idxinfo->val[d], first->idxinfo->val[d]);
+        for(const auto &elempair: scan.elems)
+            if(elempair.first->def!=def && may_alias(elempair.first->def, def))
+                ok = false;
+        for(const auto &elempair: condscan.elems)
+            if(may_alias(elempair.first->def, def))
+                ok = false;
+        // the address is used anyway once the guard passes, so the load and store are safe
+        bool definite = false;
+        for(const auto &elempair: definitescan.elems)
+            definite = definite || elempair.first->def==def;
+        if(ok && definite)
+            promoted_defs.push_back(def);
+    }
+    if(promoted_defs.empty())
+        return false;
+
+    /*
+     *     if !cond goto lskip
+     *     t = A[..]                    <- each promoted element
+     * lbody:
+     *     body                         <- A[..] is t
+     * ltest:
+     *     if cond goto lbody
+     * ldone:
+     *     A[..] = t                    <- if written
+     * lskip:
+     */
+    int lbody = func->gen_label();
+    int lskip = func->gen_label();
+    ltest = func->gen_label();
+    ldone = func->gen_label();
+
+    cond->gen_cond(func, -1, lskip);
+    for(auto def: promoted_defs) {
+        RVal t = nodes[def][0]->gen_rval(func);
+        assert(t.type==RVal::TempVar);
+        for(auto node: nodes[def])
+            node->promoted = t.val.tempvar;
+    }
+
+    func->push_stmt(new IrLabel(func, lbody), "promoted while - lbody");
+    body->gen_ir(func);
+    func->push_stmt(new IrLabel(func, ltest), "promoted while - ltest");
+    cond->gen_cond(func, lbody, -1);
+    func->push_stmt(new IrLabel(func, ldone), "promoted while - ldone");
+
+    for(auto def: promoted_defs) {
+        auto first = nodes[def][0];
+        RVal t = RVal::asTempVar(first->promoted);
+        for(auto node: nodes[def])
+            node->promoted = -1;
+        if(dirty[def])
+            first->gen_store(func, t);
+    }
+    func->push_stmt(new IrLabel(func, lskip), "promoted while - lskip");
+    return true;
+}
@@ -276,6 +276,7 @@ public:
                         node->name.c_str(), i,
                         expect_depth, var_depth, idx_depth
                     );
+                lval->def->effectively_const = false; // callee may write through it
             } else { // expected primitive
                 if(!lval) { // not a lval
                     // good, because exp is always primitive
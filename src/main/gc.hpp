@@ -11,6 +11,9 @@ struct GarbageCollectable {
     GarbageCollectable() {
         allocated_ptrs.push_back(this);
     }
+    GarbageCollectable(const GarbageCollectable&) {
+        allocated_ptrs.push_back(this);
+    }
     virtual ~GarbageCollectable() = default;
 
     static void delete_all() {
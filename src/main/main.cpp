@@ -13,6 +13,11 @@ extern void yyrestart(FILE*);
 extern bool OUTPUT_REGALLOC_PREFIX;
 extern bool OUTPUT_DEF_USE;
 extern bool DO_DETECT_BUILTIN;
+extern bool STATIC_GLOBAL_INIT;
+extern bool SYNTH_CONST_MUL;
+extern bool IF_CONVERSION;
+extern bool JUMP_TABLES;
+extern bool MASK_REMAINDERS;
 
 #define mainerror(...) do { \
     printf("main error: "); \
@@ -92,6 +97,15 @@ int main(int argc, char **argv) {
         OUTPUT_DEF_USE = false;
         skip_analyze = true;
     }
+    if(output_format!=Assembly) {
+        IF_CONVERSION = false; // eeyore and tigger have no bitwise ops for the masks
+        JUMP_TABLES = false; // nor indirect jumps, chains become decision trees there
+        MASK_REMAINDERS = false;
+    }
+    if(output_format==Tigger) {
+        STATIC_GLOBAL_INIT = false; // tigger has no initialized data for arrays
+        SYNTH_CONST_MUL = false; // nor shifts, they are muls there as well
+    }
 
     /// PARSE
     yyparse();
@@ -105,8 +119,23 @@ int main(int argc, char **argv) {
 
 
     /// OPTIMIZE IR
-    for(auto func: ir_root->funcs)
+    ir_root->specialize_calls();
+    ir_root->inline_builtin_calls();
+
+    for(auto func: ir_root->funcs) {
+        func.first->split_local_arrays();
         for(int round=0; round<3 && func.first->peekhole_optimize(); round++);
+        func.first->combine_insts(); // after peekhole, which expects each tempvar read once
+    }
+    ir_root->memoize_pure_funcs();
+
+    ir_root->calc_modref_sets();
+    for(auto func: ir_root->funcs) {
+        func.first->promote_globals();
+        func.first->hoist_loop_consts();
+        func.first->eliminate_dead_code();
+    }
+    ir_root->drop_unused_globals();
 
     /// GEN CFG, REG ALLOC, CALC DESTROY SET
     if(!skip_analyze) {
@@ -131,6 +160,10 @@ int main(int argc, char **argv) {
     auto *inst_root = new InstRoot();
     ir_root->gen_inst(inst_root);
 
+    /// OPTIMIZE INST
+    for(auto fn: inst_root->funcs)
+        fn->optimize_layout();
+
     /// OUTPUT TIGGER
     if(output_format==Tigger) {
         inst_root->output_tigger(output_buf);